@@ -0,0 +1,192 @@
+// Host check of BinarySchema serialization: known encodings, round trips,
+// decoding of device output with BinaryBufferReader and encoded size compared to raw structs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <binary_formater.h>
+
+struct Telemetry
+{
+	uint8_t id;
+	int16_t temperature;
+	uint16_t voltage;
+	int32_t current;
+	uint32_t uptime;
+	uint8_t flags;
+};
+
+typedef BinarySchema<
+	SchemaField<Telemetry, uint8_t, &Telemetry::id>,
+	SchemaField<Telemetry, int16_t, &Telemetry::temperature, Varint>,
+	SchemaField<Telemetry, uint16_t, &Telemetry::voltage, Varint>,
+	SchemaField<Telemetry, int32_t, &Telemetry::current, Varint>,
+	SchemaField<Telemetry, uint32_t, &Telemetry::uptime, Varint>,
+	SchemaField<Telemetry, uint8_t, &Telemetry::flags>
+	> TelemetrySchema;
+
+typedef BinarySchema<
+	SchemaField<Telemetry, uint8_t, &Telemetry::id>,
+	SchemaField<Telemetry, int16_t, &Telemetry::temperature, BigEndian>,
+	SchemaField<Telemetry, uint16_t, &Telemetry::voltage>,
+	SchemaField<Telemetry, int32_t, &Telemetry::current, BigEndian>,
+	SchemaField<Telemetry, uint32_t, &Telemetry::uptime>,
+	SchemaField<Telemetry, uint8_t, &Telemetry::flags, BigEndian>
+	> FixedTelemetrySchema;
+
+// Static byte stream as a device side DATA_SOURCE
+class Loopback
+{
+public:
+	static void Write(uint8_t c)
+	{
+		_buffer[_write++] = c;
+	}
+
+	static uint8_t Read()
+	{
+		return _buffer[_read++];
+	}
+
+	static void Reset()
+	{
+		_read = _write = 0;
+	}
+
+	static const uint8_t *Data()
+	{
+		return _buffer;
+	}
+
+	static size_t Size()
+	{
+		return _write;
+	}
+
+private:
+	static uint8_t _buffer[256];
+	static size_t _read, _write;
+};
+
+uint8_t Loopback::_buffer[256];
+size_t Loopback::_read = 0;
+size_t Loopback::_write = 0;
+
+typedef BinaryFormater<Loopback> Device;
+
+static unsigned errors = 0;
+
+template<class Encoding, class T>
+void CheckEncoding(T value, const char *expected)
+{
+	uint8_t buffer[16];
+	BinaryBufferWriter writer(buffer, sizeof(buffer));
+	Encoding::Write(writer, value);
+	char hex[64], *p = hex;
+	for(size_t i = 0; i < writer.Size(); i++)
+		p += sprintf(p, "%02x", buffer[i]);
+	*p = 0;
+
+	BinaryBufferReader reader(buffer, writer.Size());
+	T decoded = 0;
+	Encoding::Read(reader, decoded);
+	if(strcmp(hex, expected) != 0 || decoded != value || reader.Position() != writer.Size())
+	{
+		printf("encoding %lld: expected %s, got %s, decoded %lld\n", (long long)value, expected, hex, (long long)decoded);
+		errors++;
+	}
+}
+
+bool Equal(const Telemetry &a, const Telemetry &b)
+{
+	return a.id == b.id && a.temperature == b.temperature && a.voltage == b.voltage &&
+		a.current == b.current && a.uptime == b.uptime && a.flags == b.flags;
+}
+
+// Values of a typical sensor: mostly small numbers
+Telemetry RandomTelemetry()
+{
+	Telemetry t;
+	t.id = rand();
+	t.temperature = rand() % 800 - 200;
+	t.voltage = rand() % 5000;
+	t.current = rand() % 4000 - 2000;
+	t.uptime = rand() % 4 == 0 ? ((uint32_t)rand() << 16 ^ rand()) : rand() % 100000;
+	t.flags = rand();
+	return t;
+}
+
+template<class Schema>
+size_t CheckRoundTrip(const Telemetry &t)
+{
+	uint8_t buffer[Schema::MaxSize];
+	BinaryBufferWriter writer(buffer, sizeof(buffer));
+	Schema::Write(writer, t);
+	Telemetry decoded;
+	memset(&decoded, 0, sizeof(decoded));
+	BinaryBufferReader reader(buffer, writer.Size());
+	Schema::Read(reader, decoded);
+	if(writer.Overrun() || reader.Overrun() || reader.Position() != writer.Size() || !Equal(t, decoded))
+	{
+		if(errors < 10)
+			printf("round trip failed, %u bytes\n", (unsigned)writer.Size());
+		errors++;
+	}
+	return writer.Size();
+}
+
+int main()
+{
+	CheckEncoding<LittleEndian>((uint16_t)0x1234, "3412");
+	CheckEncoding<BigEndian>((uint16_t)0x1234, "1234");
+	CheckEncoding<LittleEndian>((int32_t)-2, "feffffff");
+	CheckEncoding<BigEndian>((uint32_t)0x01020304, "01020304");
+	CheckEncoding<Varint>((uint16_t)0, "00");
+	CheckEncoding<Varint>((uint16_t)127, "7f");
+	CheckEncoding<Varint>((uint16_t)300, "ac02");
+	CheckEncoding<Varint>((uint16_t)0xffff, "ffff03");
+	CheckEncoding<Varint>((uint32_t)0xffffffff, "ffffffff0f");
+	CheckEncoding<Varint>((int16_t)0, "00");
+	CheckEncoding<Varint>((int16_t)-1, "01");
+	CheckEncoding<Varint>((int16_t)1, "02");
+	CheckEncoding<Varint>((int16_t)-64, "7f");
+	CheckEncoding<Varint>((int16_t)64, "8001");
+	CheckEncoding<Varint>((int16_t)-32768, "ffff03");
+	CheckEncoding<Varint>((int32_t)(-2147483647 - 1), "ffffffff0f");
+	CheckEncoding<Varint>((int8_t)-128, "ff01");
+	CheckEncoding<Varint>((uint8_t)200, "c801");
+
+	// truncated input is reported
+	uint8_t truncated[] = {0x80, 0x80};
+	BinaryBufferReader reader(truncated, sizeof(truncated));
+	uint32_t value;
+	Varint::Read(reader, value);
+	if(!reader.Overrun())
+		printf("truncated varint is not detected\n"), errors++;
+
+	// device side formater, decoded on host
+	Telemetry sent = RandomTelemetry(), received;
+	Loopback::Reset();
+	Device::WriteFields<TelemetrySchema>(sent);
+	Device::ReadFields<TelemetrySchema>(received);
+	BinaryBufferReader hostReader(Loopback::Data(), Loopback::Size());
+	Telemetry decoded;
+	TelemetrySchema::Read(hostReader, decoded);
+	if(!Equal(sent, received) || !Equal(sent, decoded))
+		printf("device stream mismatch\n"), errors++;
+
+	const unsigned count = 100000;
+	size_t varintSize = 0, fixedSize = 0;
+	for(unsigned i = 0; i < count; i++)
+	{
+		Telemetry t = RandomTelemetry();
+		varintSize += CheckRoundTrip<TelemetrySchema>(t);
+		fixedSize += CheckRoundTrip<FixedTelemetrySchema>(t);
+	}
+	printf("check: %u errors\n", errors);
+	printf("raw struct:      %u bytes\n", (unsigned)sizeof(Telemetry));
+	printf("fixed schema:    %.2f bytes, max %d\n", (double)fixedSize / count, (int)FixedTelemetrySchema::MaxSize);
+	printf("varint schema:   %.2f bytes, max %d\n", (double)varintSize / count, (int)TelemetrySchema::MaxSize);
+	return errors != 0;
+}
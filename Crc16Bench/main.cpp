@@ -0,0 +1,140 @@
+// Host check and benchmark of CRC16 0x8408 engines.
+// Cycles are CPU timestamp counter ticks of the host, they show relative cost of the engines,
+// not AVR cycles.
+// Checks compile time CRC against the engines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include <Crc16.h>
+
+static unsigned errors = 0;
+
+// Rfm70 bank 1 register 15 init value
+static const uint8_t Reg15[] PROGMEM = {0x41, 0x20, 0x08, 0x04, 0x81, 0x20, 0xCF, 0xF7, 0xFE, 0xFF, 0xFF};
+
+enum
+{
+	Reg15Crc = StaticCrc16<0xffff, 0x41, 0x20, 0x08, 0x04, 0x81, 0x20, 0xCF, 0xF7, 0xFE, 0xFF, 0xFF>::value,
+	// USB vendor and product id
+	UsbIdCrc = StaticCrc16Word<StaticCrc16Word<0xffff, 0x16c0>::value, 0x05dc>::value,
+	DwordCrc = StaticCrc16Dword<0xffff, 0xE2014B40>::value,
+	ChainedCrc = StaticCrc16<StaticCrc16<0xffff, 0x41, 0x20, 0x08>::value, 0x04, 0x81>::value
+};
+
+void CheckStatic()
+{
+	const uint8_t usbId[] = {0xc0, 0x16, 0xdc, 0x05};
+	const uint8_t dword[] = {0x40, 0x4b, 0x01, 0xe2};
+	if(Crc16<Crc16Table>(Reg15, sizeof(Reg15), 0xffff) != Reg15Crc)
+		printf("static crc: %04x\n", Reg15Crc), errors++;
+	if(Crc16<Crc16Table>(usbId, sizeof(usbId), 0xffff) != UsbIdCrc)
+		printf("static word crc: %04x\n", UsbIdCrc), errors++;
+	if(Crc16<Crc16Table>(dword, sizeof(dword), 0xffff) != DwordCrc)
+		printf("static dword crc: %04x\n", DwordCrc), errors++;
+	if(Crc16<Crc16Table>(Reg15, 5, 0xffff) != ChainedCrc)
+		printf("chained static crc: %04x\n", ChainedCrc), errors++;
+	for(unsigned i = 0; i < 256; i++)
+		if(pgm_read_word(Crc16Table::Table() + i) != CrcTable0x8408(i))
+			printf("table entry %u\n", i), errors++;
+	for(unsigned i = 0; i < 16; i++)
+	{
+		uint16_t v = i;
+		for(uint8_t bit = 0; bit < 4; bit++)
+			v = v & 1 ? (v >> 1) ^ 0x8408 : v >> 1;
+		if(pgm_read_word(Crc16NibbleTable::Table() + i) != v)
+			printf("nibble table entry %u\n", i), errors++;
+	}
+}
+
+template<class Engine>
+void CheckEngine(const char *name, const uint8_t *data, uint32_t size)
+{
+	const uint8_t check[] = "123456789";
+	// CRC-16/MCRF4XX check value
+	uint16_t crc = Crc16<Engine>(check, 9, 0xffff);
+	if(crc != 0x6f91)
+		printf("%s: check value %04x\n", name, crc), errors++;
+
+	uint16_t expected = 0xffff;
+	for(uint32_t i = 0; i < size; i++)
+		expected = Crc16Bitwise::Update(data[i], expected);
+	crc = 0xffff;
+	for(uint32_t i = 0; i < size; i++)
+		crc = Engine::Update(data[i], crc);
+	if(crc != expected)
+		printf("%s: %04x, expected %04x\n", name, crc, expected), errors++;
+}
+
+struct Timer
+{
+	Timer()
+		:start(clock())
+	{
+#ifdef HAVE_RDTSC
+		ticks = __rdtsc();
+#endif
+	}
+
+	void Print(const char *name, uint32_t bytes)
+	{
+		double ns = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / bytes;
+#ifdef HAVE_RDTSC
+		double cycles = (double)(__rdtsc() - ticks) / bytes;
+		printf("%-18s %6.2f ns/byte %6.2f cycles/byte\n", name, ns, cycles);
+#else
+		printf("%-18s %6.2f ns/byte\n", name, ns);
+#endif
+	}
+
+	clock_t start;
+	unsigned long long ticks;
+};
+
+template<class Engine>
+uint16_t Bench(const char *name, const uint8_t *data, uint32_t size)
+{
+	Timer timer;
+	uint16_t crc = 0xffff;
+	for(uint32_t i = 0; i < size; i++)
+		crc = Engine::Update(data[i], crc);
+	timer.Print(name, size);
+	return crc;
+}
+
+int main()
+{
+	const uint32_t size = 16 * 1024 * 1024;
+	uint8_t *data = new uint8_t[size];
+	for(uint32_t i = 0; i < size; i++)
+		data[i] = rand();
+
+	CheckEngine<Crc16Bitwise>("bitwise", data, 100000);
+	CheckEngine<Crc16NibbleTable>("nibble table", data, 100000);
+	CheckEngine<Crc16Table>("table", data, 100000);
+	CheckEngine<Crc16Slice8>("slice by 8", data, 100000);
+	for(uint32_t length = 0; length < 40; length++)
+	{
+		uint16_t crc = Crc16Slice8::Update(data + 3, length, 0xffff);
+		if(crc != Crc16<Crc16Bitwise>(data + 3, length, 0xffff))
+			printf("slice by 8 block of %u bytes: %04x\n", length, crc), errors++;
+	}
+	CheckStatic();
+	printf("check: %u errors\n", errors);
+
+	unsigned sum = 0;
+	sum += Bench<Crc16Bitwise>("bitwise", data, size);
+	sum += Bench<Crc16NibbleTable>("nibble table", data, size);
+	sum += Bench<Crc16Table>("table", data, size);
+	Timer timer;
+	sum += Crc16Slice8::Update(data, size, 0xffff);
+	timer.Print("slice by 8 block", size);
+
+	delete[] data;
+	return errors != 0 || sum == 0;
+}
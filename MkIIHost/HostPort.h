@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <termios.h>
+
+// POSIX link to the programmer, counterpart of ComPort in PdiTestHost.
+// Name is a serial device or pty ("/dev/ttyUSB0", "/dev/pts/3")
+// or "host:port" of a TCP socket (PdiSimulator -t port).
+class HostPort
+{
+public:
+	HostPort(const std::string &name, unsigned baud = 115200)
+		:_fd(-1), _socket(false)
+	{
+		size_t colon = name.rfind(':');
+		if(name[0] != '/' && colon != std::string::npos)
+			OpenSocket(name.substr(0, colon), name.substr(colon + 1));
+		else
+			OpenTty(name, baud);
+	}
+
+	~HostPort()
+	{
+		if(_fd >= 0)
+			close(_fd);
+	}
+
+	bool WriteBuffer(const void *buffer, size_t size)
+	{
+		const uint8_t *data = static_cast<const uint8_t *>(buffer);
+		while(size)
+		{
+			ssize_t n = write(_fd, data, size);
+			if(n < 0 && (errno == EINTR || errno == EAGAIN))
+			{
+				Wait(POLLOUT, 1000);
+				continue;
+			}
+			if(n <= 0)
+				return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	// False if the whole buffer does not arrive within timeout
+	bool ReadBuffer(void *buffer, size_t size, unsigned timeoutMs = 2000)
+	{
+		uint8_t *data = static_cast<uint8_t *>(buffer);
+		while(size)
+		{
+			ssize_t n = read(_fd, data, size);
+			if(n < 0 && (errno == EINTR || errno == EAGAIN))
+			{
+				if(!Wait(POLLIN, timeoutMs))
+					return false;
+				continue;
+			}
+			if(n <= 0)
+				return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	// TCP socket to PdiSimulator: replies are not paced to a real link
+	bool IsSocket()const
+	{
+		return _socket;
+	}
+
+	// Drops received data that was not read yet
+	void Purge()
+	{
+		uint8_t buffer[256];
+		while(Wait(POLLIN, 50) && read(_fd, buffer, sizeof(buffer)) > 0);
+	}
+
+private:
+	bool Wait(short events, unsigned timeoutMs)
+	{
+		pollfd p = {_fd, events, 0};
+		return poll(&p, 1, timeoutMs) > 0;
+	}
+
+	void OpenSocket(const std::string &host, const std::string &port)
+	{
+		addrinfo hints, *result;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if(getaddrinfo(host.c_str(), port.c_str(), &hints, &result))
+			throw std::string("Unable to resolve ") + host;
+		for(addrinfo *a = result; a && _fd < 0; a = a->ai_next)
+		{
+			_fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if(_fd >= 0 && connect(_fd, a->ai_addr, a->ai_addrlen))
+			{
+				close(_fd);
+				_fd = -1;
+			}
+		}
+		freeaddrinfo(result);
+		if(_fd < 0)
+			throw std::string("Unable to connect to ") + host + ":" + port;
+		_socket = true;
+		// small command frames must not wait for more data
+		int on = 1;
+		setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		fcntl(_fd, F_SETFL, O_NONBLOCK);
+	}
+
+	void OpenTty(const std::string &name, unsigned baud)
+	{
+		_fd = open(name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if(_fd < 0)
+			throw std::string("Unable to open port ") + name;
+		termios tio;
+		if(tcgetattr(_fd, &tio))
+			throw std::string("Not a terminal ") + name;
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+		speed_t speed = Speed(baud);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tcsetattr(_fd, TCSANOW, &tio);
+		tcflush(_fd, TCIOFLUSH);
+	}
+
+	static speed_t Speed(unsigned baud)
+	{
+		switch(baud)
+		{
+			case 9600: return B9600;
+			case 19200: return B19200;
+			case 38400: return B38400;
+			case 57600: return B57600;
+			case 115200: return B115200;
+			case 230400: return B230400;
+#ifdef B460800
+			case 460800: return B460800;
+#endif
+#ifdef B500000
+			case 500000: return B500000;
+#endif
+#ifdef B1000000
+			case 1000000: return B1000000;
+#endif
+			default:
+				throw std::string("Unsupported baud rate");
+		}
+	}
+
+	int _fd;
+	bool _socket;
+};
@@ -0,0 +1,299 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "constants.h"
+#include "Crc16.h"
+#include "HostPort.h"
+
+// Host side of the MkII protocol.
+// Commands can be posted ahead of the replies: the programmer handles
+// frames in order, so up to Depth() commands are kept in flight and replies
+// are matched by sequence number. Depth 1 is the classic request-reply mode.
+// Deeper pipelines need a link that does not drop data while the programmer
+// is busy: USB with flow control, a socket to the simulator, or short commands
+// that fit in the programmer RX queue.
+class MkIIClient
+{
+public:
+	typedef std::vector<uint8_t> Bytes;
+	// Reply bodies above MaxBody are taken as a corrupted header,
+	// the largest reply is a read of MaxChunk bytes with its response id
+	enum {EventSeq = 0xffff, MaxChunk = 0x10000, MaxBody = MaxChunk + 1};
+
+	MkIIClient(HostPort &port, unsigned depth = 1)
+		:_port(port), _seq(0), _depth(depth ? depth : 1), _errors(0), _held(false)
+	{}
+
+	unsigned Depth()const
+	{
+		return _depth;
+	}
+
+	unsigned Errors()const
+	{
+		return _errors;
+	}
+
+	unsigned InFlight()const
+	{
+		return _inFlight.size();
+	}
+
+	// Sends a command without waiting for the reply
+	void Post(const Bytes &body)
+	{
+		Bytes frame;
+		frame.push_back(MessageStart);
+		Put16(frame, _seq);
+		Put32(frame, body.size());
+		frame.push_back(Token);
+		frame.insert(frame.end(), body.begin(), body.end());
+		Put16(frame, Crc(frame, frame.size()));
+		if(!_port.WriteBuffer(&frame[0], frame.size()))
+			Error("write failed");
+		_inFlight.push_back(_seq);
+		_seq = (_seq + 1) & 0x7fff;
+	}
+
+	// Reply body of the oldest command in flight: response id and data.
+	// Replies come in order, so a reply to a later command in flight means this
+	// one was lost: it is failed with an empty body and the reply is kept for its command.
+	Bytes Wait()
+	{
+		if(_inFlight.empty())
+			return Bytes();
+		uint16_t seq = _inFlight.front();
+		_inFlight.pop_front();
+		if(_held)
+			return TakeHeld(seq);
+		for(;;)
+		{
+			uint16_t replySeq;
+			Bytes reply;
+			if(!ReadFrame(replySeq, reply))
+				return Bytes();
+			if(replySeq == EventSeq)
+				continue;
+			if(replySeq == seq)
+				return reply;
+			if(IsInFlight(replySeq))
+			{
+				_held = true;
+				_heldSeq = replySeq;
+				_heldReply.swap(reply);
+				return TakeHeld(seq);
+			}
+			Error("reply out of sequence");
+		}
+	}
+
+	Bytes Command(const Bytes &body)
+	{
+		Drain();
+		Post(body);
+		return Wait();
+	}
+
+	// Waits for all replies, false if any of them is not the expected status
+	bool Drain(uint8_t expected = RSP_OK)
+	{
+		bool ok = true;
+		while(!_inFlight.empty())
+			if(Status(Wait()) != expected)
+				ok = false;
+		return ok;
+	}
+
+	uint8_t Simple(uint8_t command)
+	{
+		return Status(Command(Bytes(1, command)));
+	}
+
+	uint8_t SetParameter(uint8_t parameter, uint8_t value)
+	{
+		Bytes body;
+		body.push_back(CMND_SET_PARAMETER);
+		body.push_back(parameter);
+		body.push_back(value);
+		return Status(Command(body));
+	}
+
+	uint8_t Erase(uint8_t mode, uint32_t address)
+	{
+		Bytes body;
+		body.push_back(CMND_XMEGA_ERASE);
+		body.push_back(mode);
+		Put32(body, address);
+		return Status(Command(body));
+	}
+
+	// Page writes are pipelined up to Depth(). The programmer reports a page
+	// with the reply to the next command, CMND_CLEAR_EVENTS collects the last one.
+	bool WriteMem(uint8_t memType, uint32_t address, const uint8_t *data, uint32_t size, uint32_t pageSize)
+	{
+		bool ok = true;
+		for(uint32_t offset = 0; offset < size; offset += pageSize)
+		{
+			uint32_t chunk = size - offset < pageSize ? size - offset : pageSize;
+			if(_inFlight.size() >= _depth && Status(Wait()) != RSP_OK)
+				ok = false;
+			Bytes body;
+			body.push_back(CMND_WRITE_MEMORY);
+			body.push_back(memType);
+			Put32(body, chunk);
+			Put32(body, address + offset);
+			body.insert(body.end(), data + offset, data + offset + chunk);
+			Post(body);
+		}
+		if(_inFlight.size() >= _depth && Status(Wait()) != RSP_OK)
+			ok = false;
+		Post(Bytes(1, CMND_CLEAR_EVENTS));
+		return Drain() && ok;
+	}
+
+	// Reads are split in chunks, pipelined up to Depth()
+	bool ReadMem(uint8_t memType, uint32_t address, uint8_t *data, uint32_t size, uint32_t chunkSize)
+	{
+		bool ok = true;
+		uint32_t posted = 0, received = 0;
+		while(received < size)
+		{
+			if(posted < size && _inFlight.size() < _depth)
+			{
+				uint32_t chunk = size - posted < chunkSize ? size - posted : chunkSize;
+				Bytes body;
+				body.push_back(CMND_READ_MEMORY);
+				body.push_back(memType);
+				Put32(body, chunk);
+				Put32(body, address + posted);
+				Post(body);
+				posted += chunk;
+				continue;
+			}
+			uint32_t chunk = size - received < chunkSize ? size - received : chunkSize;
+			Bytes reply = Wait();
+			if(Status(reply) != RSP_MEMORY || reply.size() != chunk + 1)
+			{
+				ok = false;
+				reply.assign(chunk + 1, 0xff);
+			}
+			memcpy(data + received, &reply[1], chunk);
+			received += chunk;
+		}
+		return ok;
+	}
+
+	bool Crc(uint8_t section, uint32_t &crc)
+	{
+		Bytes body;
+		body.push_back(CMND_XMEGA_CRC);
+		body.push_back(section);
+		Bytes reply = Command(body);
+		if(Status(reply) != RSP_MEMORY || reply.size() != 4)
+			return false;
+		crc = reply[1] | (uint32_t(reply[2]) << 8) | (uint32_t(reply[3]) << 16);
+		return true;
+	}
+
+	static uint8_t Status(const Bytes &reply)
+	{
+		return reply.empty() ? 0 : reply[0];
+	}
+
+private:
+	bool IsInFlight(uint16_t seq)const
+	{
+		for(size_t i = 0; i < _inFlight.size(); i++)
+			if(_inFlight[i] == seq)
+				return true;
+		return false;
+	}
+
+	Bytes TakeHeld(uint16_t seq)
+	{
+		if(seq != _heldSeq)
+		{
+			Error("reply lost");
+			return Bytes();
+		}
+		_held = false;
+		Bytes reply;
+		reply.swap(_heldReply);
+		return reply;
+	}
+
+	// A header with a wrong token or size does not start a frame,
+	// the search for the next MessageStart goes on after its first byte
+	bool ReadFrame(uint16_t &seq, Bytes &body)
+	{
+		uint8_t header[8];
+		size_t have = 0;
+		uint32_t size;
+		for(;;)
+		{
+			if(!_port.ReadBuffer(header + have, sizeof(header) - have))
+				return Error("reply timeout");
+			size = header[3] | (header[4] << 8) | (uint32_t(header[5]) << 16) | (uint32_t(header[6]) << 24);
+			if(header[0] == MessageStart && header[7] == Token && size <= MaxBody)
+				break;
+			if(header[0] == MessageStart)
+				Error("bad reply header");
+			size_t start = 1;
+			while(start < sizeof(header) && header[start] != MessageStart)
+				start++;
+			have = sizeof(header) - start;
+			memmove(header, header + start, have);
+		}
+		seq = header[1] | (header[2] << 8);
+
+		Bytes frame(header, header + sizeof(header));
+		frame.resize(sizeof(header) + size + 2);
+		if(!_port.ReadBuffer(&frame[sizeof(header)], size + 2))
+			return Error("reply timeout");
+		uint16_t crc = frame[frame.size() - 2] | (frame[frame.size() - 1] << 8);
+		if(crc != Crc(frame, frame.size() - 2))
+			return Error("reply crc");
+		body.assign(frame.begin() + sizeof(header), frame.end() - 2);
+		return true;
+	}
+
+	bool Error(const char *message)
+	{
+		fprintf(stderr, "%s\n", message);
+		_errors++;
+		return false;
+	}
+
+	static uint16_t Crc(const Bytes &b, size_t size)
+	{
+		uint16_t crc = 0xffff;
+		for(size_t i = 0; i < size; i++)
+			crc = Crc16Table::Update(b[i], crc);
+		return crc;
+	}
+
+	static void Put16(Bytes &b, uint16_t v)
+	{
+		b.push_back(v & 0xff);
+		b.push_back(v >> 8);
+	}
+
+	static void Put32(Bytes &b, uint32_t v)
+	{
+		Put16(b, v & 0xffff);
+		Put16(b, v >> 16);
+	}
+
+	HostPort &_port;
+	uint16_t _seq;
+	unsigned _depth;
+	unsigned _errors;
+	std::deque<uint16_t> _inFlight;
+	// reply that came for a later command while an earlier reply was lost
+	bool _held;
+	uint16_t _heldSeq;
+	Bytes _heldReply;
+};
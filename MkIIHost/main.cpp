@@ -0,0 +1,232 @@
+// MkII host client for Linux and other POSIX systems.
+// Programs and reads XMega flash through the PDI programmer over a serial
+// device, a pty or a TCP socket to PdiSimulator, and measures throughput.
+//
+//	MkIIHost [options] port command [image]
+//	port	/dev/ttyUSB0, /dev/pts/N or host:port
+//	Times over host:port are wall-clock times of the unpaced simulator,
+//	not of a real link: use the PdiSimulator benchmark for simulated times.
+//	commands:
+//		info			sign on
+//		erase			chip erase
+//		write image		erase, program and verify a raw binary image
+//		read image		read -s bytes of flash to a file
+//		bench image		erase, write and read times in KB/s, -n times
+//	options:
+//		-b baud		serial baud rate (115200)
+//		-d depth	commands in flight (1)
+//		-a address	flash base address (0x800000)
+//		-p size		page size (256)
+//		-c size		read chunk size (256), up to 65536
+//		-s size		read size (32768)
+//		-n count	bench loops (1), for soak tests
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "MkIIClient.h"
+
+typedef MkIIClient::Bytes Bytes;
+
+struct Options
+{
+	Options()
+		:baud(115200), depth(1), address(0x800000), pageSize(256),
+		chunkSize(256), readSize(32768), loops(1)
+	{}
+	unsigned baud;
+	unsigned depth;
+	uint32_t address;
+	uint32_t pageSize;
+	uint32_t chunkSize;
+	uint32_t readSize;
+	unsigned loops;
+};
+
+static double Now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static bool LoadImage(const char *name, Bytes &image)
+{
+	FILE *f = fopen(name, "rb");
+	if(!f)
+		return false;
+	uint8_t buffer[4096];
+	size_t n;
+	while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		image.insert(image.end(), buffer, buffer + n);
+	fclose(f);
+	return !image.empty();
+}
+
+static bool SaveImage(const char *name, const Bytes &image)
+{
+	FILE *f = fopen(name, "wb");
+	if(!f)
+		return false;
+	bool ok = fwrite(&image[0], 1, image.size(), f) == image.size();
+	fclose(f);
+	return ok;
+}
+
+static bool Connect(MkIIClient &client)
+{
+	if(MkIIClient::Status(client.Command(Bytes(1, CMND_GET_SIGN_ON))) != RSP_SIGN_ON)
+	{
+		fprintf(stderr, "no programmer\n");
+		return false;
+	}
+	if(client.SetParameter(EmulatorMODE, PDI_XMEGA) != RSP_OK ||
+		client.Simple(CMND_ENTER_PROGMODE) != RSP_OK)
+	{
+		fprintf(stderr, "can not enter programming mode\n");
+		return false;
+	}
+	return true;
+}
+
+static void Disconnect(MkIIClient &client)
+{
+	client.Simple(CMND_LEAVE_PROGMODE);
+}
+
+// One erase, write, read back cycle. Prints KB/s of each step.
+static bool Program(MkIIClient &client, const Options &o, const Bytes &image, bool report)
+{
+	double start = Now();
+	if(client.Erase(XMEGA_ERASE_CHIP, 0) != RSP_OK)
+	{
+		fprintf(stderr, "erase failed\n");
+		return false;
+	}
+	double erased = Now();
+
+	if(!client.WriteMem(XMEGA_APPLICATION_FLASH, o.address, &image[0], image.size(), o.pageSize))
+	{
+		fprintf(stderr, "write failed\n");
+		return false;
+	}
+	double written = Now();
+
+	Bytes readBack(image.size());
+	bool ok = client.ReadMem(XMEGA_APPLICATION_FLASH, o.address, &readBack[0], readBack.size(), o.chunkSize);
+	double read = Now();
+	if(!ok || readBack != image)
+	{
+		fprintf(stderr, "verify failed\n");
+		ok = false;
+	}
+
+	if(report)
+	{
+		double kb = image.size() / 1024.0;
+		printf("erase %.2f KB/s (%.1f ms), write %.2f KB/s, read %.2f KB/s, total %.2f s\n",
+			kb / (erased - start), (erased - start) * 1000, kb / (written - erased), kb / (read - written), read - start);
+	}
+	return ok;
+}
+
+static int Usage()
+{
+	printf("usage: MkIIHost [-b baud] [-d depth] [-a address] [-p page] [-c chunk] [-s size] [-n loops]\n"
+		"\tport info|erase|write image|read image|bench image\n");
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	Options o;
+	int arg = 1;
+	for(; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+	{
+		unsigned long value = strtoul(argv[arg + 1], 0, 0);
+		switch(argv[arg][1])
+		{
+			case 'b': o.baud = value; break;
+			case 'd': o.depth = value; break;
+			case 'a': o.address = value; break;
+			case 'p': o.pageSize = value; break;
+			case 'c': o.chunkSize = value; break;
+			case 's': o.readSize = value; break;
+			case 'n': o.loops = value; break;
+			default: return Usage();
+		}
+	}
+	if(argc - arg < 2 || !o.pageSize || !o.chunkSize || o.chunkSize > MkIIClient::MaxChunk)
+		return Usage();
+	std::string command = argv[arg + 1];
+	const char *file = argc - arg > 2 ? argv[arg + 2] : 0;
+	if(!file && (command == "write" || command == "read" || command == "bench"))
+		return Usage();
+
+	try
+	{
+		HostPort port(argv[arg], o.baud);
+		MkIIClient client(port, o.depth);
+		if(command == "info")
+		{
+			Bytes signOn = client.Command(Bytes(1, CMND_GET_SIGN_ON));
+			if(MkIIClient::Status(signOn) != RSP_SIGN_ON)
+				return fprintf(stderr, "no programmer\n"), 1;
+			std::string name;
+			if(signOn.size() > 16)
+				name.assign(signOn.begin() + 16, signOn.end());
+			printf("programmer: %s\n", name.c_str());
+			return 0;
+		}
+
+		Bytes image;
+		if((command == "write" || command == "bench") && !LoadImage(file, image))
+			return fprintf(stderr, "can not read %s\n", file), 1;
+		if(!Connect(client))
+			return 1;
+		if(port.IsSocket() && command != "erase")
+			printf("note: simulator replies are not paced, times are host wall-clock\n");
+
+		bool ok = true;
+		if(command == "erase")
+			ok = client.Erase(XMEGA_ERASE_CHIP, 0) == RSP_OK;
+		else if(command == "write")
+			ok = Program(client, o, image, true);
+		else if(command == "read")
+		{
+			image.resize(o.readSize);
+			double start = Now();
+			ok = client.ReadMem(XMEGA_APPLICATION_FLASH, o.address, &image[0], image.size(), o.chunkSize);
+			printf("read %.2f KB/s\n", image.size() / 1024.0 / (Now() - start));
+			ok = SaveImage(file, image) && ok;
+		}
+		else if(command == "bench")
+		{
+			unsigned failed = 0;
+			for(unsigned i = 0; i < o.loops; i++)
+			{
+				printf("%u: ", i + 1);
+				if(!Program(client, o, image, true))
+					failed++;
+				fflush(stdout);
+			}
+			printf("%u of %u cycles failed, %u link errors\n", failed, o.loops, client.Errors());
+			ok = failed == 0;
+		}
+		else
+		{
+			Disconnect(client);
+			return Usage();
+		}
+		Disconnect(client);
+		return ok && client.Errors() == 0 ? 0 : 1;
+	}
+	catch(const std::string &error)
+	{
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+}
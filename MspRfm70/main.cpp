@@ -19,6 +19,7 @@ int main( void )
   // Stop watchdog timer to prevent time out reset
   DebugPin::SetDirWrite();
   WDTCTL = WDTPW + WDTHOLD;
+  Spi::Init();
   Transiver1::Init();
 
   Transiver1::SwitchToTxMode();
@@ -1,7 +1,8 @@
 
 #include "Crc16.h"
 
-	template<class DATA_SOURCE, bool calcRxCrc=false>
+	// Crc is one of Crc16.h engines
+	template<class DATA_SOURCE, bool calcRxCrc=false, class Crc=Crc16Engine>
 	class CheckSummUpdater :public DATA_SOURCE
 	{
 	public:
@@ -10,7 +11,7 @@
 		{
 			if(DATA_SOURCE::Putch(c))
 			{
-				_writeCrc = Crc16_0x8408(c, _writeCrc);
+				_writeCrc = Crc::Update(c, _writeCrc);
 				return 1;
 			}
 			return 0;
@@ -21,7 +22,7 @@
 			if(DATA_SOURCE::Getch(c))
 			{
 				if(calcRxCrc)
-					_readCrc = Crc16_0x8408(c, _readCrc);
+					_readCrc = Crc::Update(c, _readCrc);
 				return 1;
 			}
 			return 0;
@@ -30,14 +31,14 @@
 		static void Write(uint8_t c)
 		{
 			DATA_SOURCE::Write(c);
-			_writeCrc = Crc16_0x8408(c, _writeCrc);
+			_writeCrc = Crc::Update(c, _writeCrc);
 		}
 
 		static uint8_t Read()
 		{
 			uint8_t c = DATA_SOURCE::Read();
 			if(calcRxCrc)
-				_readCrc = Crc16_0x8408(c, _readCrc);
+				_readCrc = Crc::Update(c, _readCrc);
 			return c;
 		}
 
@@ -74,6 +75,14 @@
 			DATA_SOURCE::EndTxFrame();
 		}
 
+		// Ends the frame with inverted CRC, so the receiver drops it as damaged
+		static void AbortTxFrame()
+		{
+			_writeCrc = ~_writeCrc;
+			WriteCrc();
+			DATA_SOURCE::EndTxFrame();
+		}
+
 		static void BeginRx()
 		{
 			DATA_SOURCE::BeginTxFrame();
@@ -88,8 +97,8 @@
 		static uint16_t _readCrc;
 	};
 
-	template<class DATA_SOURCE, bool calcRxCrc>
-	uint16_t CheckSummUpdater<DATA_SOURCE, calcRxCrc>::_writeCrc=0xffff;
+	template<class DATA_SOURCE, bool calcRxCrc, class Crc>
+	uint16_t CheckSummUpdater<DATA_SOURCE, calcRxCrc, Crc>::_writeCrc=0xffff;
 
-	template<class DATA_SOURCE, bool calcRxCrc>
-	uint16_t CheckSummUpdater<DATA_SOURCE, calcRxCrc>::_readCrc=0xffff;
+	template<class DATA_SOURCE, bool calcRxCrc, class Crc>
+	uint16_t CheckSummUpdater<DATA_SOURCE, calcRxCrc, Crc>::_readCrc=0xffff;
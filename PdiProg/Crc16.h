@@ -1,6 +1,18 @@
 #ifndef CRC16_H
 #define CRC16_H
 #include <inttypes.h>
+#include <avr/pgmspace.h>
+#include <static_assert.h>
+
+// CRC16 with reflected polynomial 0x8408 (CRC-CCITT, LSB first) as used by the MkII protocol.
+// Engines give the same result and differ in speed and footprint:
+//	Crc16Bitwise		no table, 8 shift steps per byte
+//	Crc16NibbleTable	32 bytes of flash, 2 lookups per byte
+//	Crc16Table			512 bytes of flash, 1 lookup per byte
+//	Crc16Slice8			host only, 4 KB table in RAM, 8 bytes per step
+// Crc16_0x8408() uses Crc16Table, define CRC16_USE_NIBBLE_TABLE or CRC16_USE_BITWISE
+// to trade speed for flash on small parts.
+// StaticCrc16 computes CRC of constant data at compile time.
 
 
 
@@ -11,18 +23,218 @@ inline uint16_t CrcTable0x8408(uint16_t v)
     return v;
 }
 
+// Value shifted through the polynomial Bits times
+template<uint16_t Value, int Bits>
+struct StaticCrc16Shift
+{
+	static const uint16_t value = StaticCrc16Shift<(Value & 1) ? ((Value >> 1) ^ 0x8408) : (Value >> 1), Bits - 1>::value;
+};
+
+template<uint16_t Value>
+struct StaticCrc16Shift<Value, 0>
+{
+	static const uint16_t value = Value;
+};
+
+template<uint16_t Crc, uint8_t Byte>
+struct StaticCrc16Byte
+{
+	static const uint16_t value = (Crc >> 8) ^ StaticCrc16Shift<(Crc ^ Byte) & 0xff, 8>::value;
+};
+
+// CRC of up to 24 constant bytes at compile time, Crc is initial value.
+// Longer data is chained: StaticCrc16<StaticCrc16<0xffff, ...>::value, ...>
+//	enum{ConfigCrc = StaticCrc16<0xffff, 0x41, 0x20, 0x08>::value};
+template<uint16_t Crc, int Byte0 = -1, int Byte1 = -1, int Byte2 = -1, int Byte3 = -1,
+	int Byte4 = -1, int Byte5 = -1, int Byte6 = -1, int Byte7 = -1,
+	int Byte8 = -1, int Byte9 = -1, int Byte10 = -1, int Byte11 = -1,
+	int Byte12 = -1, int Byte13 = -1, int Byte14 = -1, int Byte15 = -1,
+	int Byte16 = -1, int Byte17 = -1, int Byte18 = -1, int Byte19 = -1,
+	int Byte20 = -1, int Byte21 = -1, int Byte22 = -1, int Byte23 = -1>
+struct StaticCrc16
+{
+	static const uint16_t value = StaticCrc16<StaticCrc16Byte<Crc, Byte0>::value,
+		Byte1, Byte2, Byte3, Byte4, Byte5, Byte6, Byte7, Byte8, Byte9, Byte10, Byte11,
+		Byte12, Byte13, Byte14, Byte15, Byte16, Byte17, Byte18, Byte19, Byte20, Byte21, Byte22, Byte23>::value;
+};
+
+template<uint16_t Crc>
+struct StaticCrc16<Crc>
+{
+	static const uint16_t value = Crc;
+};
+
+// 16 and 32 bit values, LSB first as they are stored
+template<uint16_t Crc, uint16_t Value>
+struct StaticCrc16Word
+{
+	static const uint16_t value = StaticCrc16<Crc, Value & 0xff, (Value >> 8)>::value;
+};
+
+template<uint16_t Crc, uint32_t Value>
+struct StaticCrc16Dword
+{
+	static const uint16_t value = StaticCrc16<Crc, Value & 0xff, (Value >> 8) & 0xff,
+		(Value >> 16) & 0xff, (Value >> 24)>::value;
+};
+
+struct Crc16Bitwise
+{
+	static uint16_t Update(uint8_t c, uint16_t crc)
+	{
+		return (crc >> 8) ^ CrcTable0x8408((crc ^ c) & 0x00ff);
+	}
+};
+
+struct Crc16NibbleTable
+{
+	static const uint16_t *Table()
+	{
+#define CRC16_NIBBLE(i) StaticCrc16Shift<i, 4>::value
+		static const uint16_t table[16] PROGMEM =
+		{
+			CRC16_NIBBLE(0), CRC16_NIBBLE(1), CRC16_NIBBLE(2), CRC16_NIBBLE(3),
+			CRC16_NIBBLE(4), CRC16_NIBBLE(5), CRC16_NIBBLE(6), CRC16_NIBBLE(7),
+			CRC16_NIBBLE(8), CRC16_NIBBLE(9), CRC16_NIBBLE(10), CRC16_NIBBLE(11),
+			CRC16_NIBBLE(12), CRC16_NIBBLE(13), CRC16_NIBBLE(14), CRC16_NIBBLE(15)
+		};
+#undef CRC16_NIBBLE
+		return table;
+	}
+
+	static uint16_t Update(uint8_t c, uint16_t crc)
+	{
+		crc ^= c;
+		crc = (crc >> 4) ^ pgm_read_word(Table() + (crc & 0x0f));
+		crc = (crc >> 4) ^ pgm_read_word(Table() + (crc & 0x0f));
+		return crc;
+	}
+};
+
+struct Crc16Table
+{
+	static const uint16_t *Table()
+	{
+		// generated at compile time, cannot get out of sync with the polynomial
+#define CRC16_ENTRY(i) StaticCrc16Shift<i, 8>::value
+#define CRC16_ROW(i) CRC16_ENTRY(i), CRC16_ENTRY(i + 1), CRC16_ENTRY(i + 2), CRC16_ENTRY(i + 3), \
+			CRC16_ENTRY(i + 4), CRC16_ENTRY(i + 5), CRC16_ENTRY(i + 6), CRC16_ENTRY(i + 7)
+		static const uint16_t table[256] PROGMEM =
+		{
+			CRC16_ROW(0),
+			CRC16_ROW(8),
+			CRC16_ROW(16),
+			CRC16_ROW(24),
+			CRC16_ROW(32),
+			CRC16_ROW(40),
+			CRC16_ROW(48),
+			CRC16_ROW(56),
+			CRC16_ROW(64),
+			CRC16_ROW(72),
+			CRC16_ROW(80),
+			CRC16_ROW(88),
+			CRC16_ROW(96),
+			CRC16_ROW(104),
+			CRC16_ROW(112),
+			CRC16_ROW(120),
+			CRC16_ROW(128),
+			CRC16_ROW(136),
+			CRC16_ROW(144),
+			CRC16_ROW(152),
+			CRC16_ROW(160),
+			CRC16_ROW(168),
+			CRC16_ROW(176),
+			CRC16_ROW(184),
+			CRC16_ROW(192),
+			CRC16_ROW(200),
+			CRC16_ROW(208),
+			CRC16_ROW(216),
+			CRC16_ROW(224),
+			CRC16_ROW(232),
+			CRC16_ROW(240),
+			CRC16_ROW(248)
+		};
+#undef CRC16_ROW
+#undef CRC16_ENTRY
+		return table;
+	}
+
+	static uint16_t Update(uint8_t c, uint16_t crc)
+	{
+		return (crc >> 8) ^ pgm_read_word(Table() + (uint8_t)(crc ^ c));
+	}
+};
+
+#if !defined(__AVR__)
+// Slice by 8: Tables()[k][i] is the CRC of byte i followed by k zero bytes,
+// so 8 bytes are folded with 8 independent lookups.
+struct Crc16Slice8
+{
+	static const uint16_t (*Tables())[256]
+	{
+		static uint16_t tables[8][256];
+		static bool ready = false;
+		if(!ready)
+		{
+			for(unsigned i = 0; i < 256; i++)
+				tables[0][i] = CrcTable0x8408(i);
+			for(unsigned k = 1; k < 8; k++)
+				for(unsigned i = 0; i < 256; i++)
+					tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xff];
+			ready = true;
+		}
+		return tables;
+	}
+
+	static uint16_t Update(uint8_t c, uint16_t crc)
+	{
+		return (crc >> 8) ^ Tables()[0][(uint8_t)(crc ^ c)];
+	}
+
+	static uint16_t Update(const uint8_t *data, uint32_t length, uint16_t crc)
+	{
+		const uint16_t (*t)[256] = Tables();
+		for(; length >= 8; length -= 8, data += 8)
+		{
+			crc = t[7][(uint8_t)(crc ^ data[0])] ^ t[6][(uint8_t)((crc >> 8) ^ data[1])] ^
+				t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+		}
+		for(; length; length--)
+			crc = Update(*data++, crc);
+		return crc;
+	}
+};
+#endif
+
+// CRC-16/MCRF4XX check value
+BOOST_STATIC_ASSERT((StaticCrc16<0xffff, '1', '2', '3', '4', '5', '6', '7', '8', '9'>::value == 0x6f91));
+
+#if defined(CRC16_USE_BITWISE)
+typedef Crc16Bitwise Crc16Engine;
+#elif defined(CRC16_USE_NIBBLE_TABLE)
+typedef Crc16NibbleTable Crc16Engine;
+#else
+typedef Crc16Table Crc16Engine;
+#endif
+
 inline uint16_t Crc16_0x8408(uint8_t newchar, uint16_t crcval)
 {
-    return (crcval >> 8) ^ CrcTable0x8408((crcval ^ newchar) & 0x00ff);
+    return Crc16Engine::Update(newchar, crcval);
+}
+
+template<class Engine>
+uint16_t Crc16(const uint8_t* message, uint16_t length, uint16_t crc)
+{
+	for(uint16_t i = 0; i < length; i++)
+	{
+		crc = Engine::Update(message[i], crc);
+	}
+	return crc;
 }
 
 inline uint16_t Crc16(const uint8_t* message, uint16_t length, uint16_t crc)
 {
-    for(uint16_t i = 0; i < length; i++)
-    {
-       crc = Crc16_0x8408(message[i], crc);
-    }
-    return crc;
+	return Crc16<Crc16Engine>(message, length, crc);
 }
 
 template<class T>
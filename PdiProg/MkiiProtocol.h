@@ -2,7 +2,7 @@
 #pragma once
 
 #include "Crc16.h"
-#include "ioports.h"
+#include "binary_formater.h"
 #include "xMega.h"
 #include "ProgInterface.h"
 #include "TargetDeviceCtrl.h"
@@ -21,6 +21,18 @@ namespace MkII
 		uint8_t messageId;
 	};
 
+	// Flash/EEPROM page received from host and not yet programmed
+	struct PendingPage
+	{
+		uint32_t address;
+		uint16_t size;
+		uint16_t loaded;
+		uint16_t polls;
+		uint8_t memType;
+		uint8_t buffer;
+		uint8_t state;
+	};
+
 
 //----------------------------------------------------------------------------
 // 
@@ -33,6 +45,20 @@ namespace MkII
 		>
 	class MkIIProtocol
 	{
+		// Streamed reads go to the host in chunks of this size,
+		// host link drains one chunk while the next is read from the target
+		enum {ReadChunkSize = 32};
+		// Steps of a pending page write, one step goes between two received host bytes
+		enum PageState
+		{
+			PageNone,
+			PageBegin,
+			PageLoad,
+			PageCommit,
+			PageBusy
+		};
+		// NVM busy polls of a page write before the target is taken as lost
+		enum {MaxBusyPolls = 50000};
 	public:
 		typedef BinaryFormater<CheckSummUpdater<WaitAdapter< HwInterface> > > interface;
 	private:
@@ -42,22 +68,33 @@ namespace MkII
 		ProgInterface *_progIface;
 		//targets
 
-		XMega::Xmega<interface> _xmega;
+		XMega::Xmega<interface, PdiInterface> _xmega;
 		NullTargetDeviceCtrl<interface> _nullTarget;
 		TargetDeviceCtrl * _target;
 		ProgParameters _params;
 		DeviceDescriptor _deviceDescriptor;
 		MessageHeader _header;
-		Array<256> _pageBuffer;
+		// ping-pong page buffers: one is received from host while the other is written to target
+		Array<256> _pageBuffer[2];
+		PendingPage _pending;
+		// no page write failed since the last reply that reported it
+		bool _pagesOk;
+		// host data of the current command did not arrive, its CRC is not waited for
+		bool _rxTimeout;
 
 	public:
 
 		MkIIProtocol()
-		:_xmega(&_params, &_deviceDescriptor)
+		:_xmega(&_pdi, &_params, &_deviceDescriptor)
 		{
 			_params.EmuMode = Unknown;
+			_params.CompareBeforeWrite = 0;
 			_progIface = &_nullProg;
 			_target = &_nullTarget;
+			_rxTimeout = false;
+			_pending.state = PageNone;
+			_pending.buffer = 0;
+			_pagesOk = true;
 		}
 
 		void SetMode(EmulatorMode mode)
@@ -84,12 +121,12 @@ namespace MkII
 			_target->SetProgInterface(_progIface);
 		}
 
-		void SendMessageHeader(uint16_t size, Responses response)
+		void SendMessageHeader(uint32_t size, Responses response)
 		{
 			interface::BeginTxFrame();
 			interface::Write(uint8_t(MessageStart));
 			interface::Write(_header.seqNumber);
-			interface::Write(uint32_t(size));
+			interface::Write(size);
 			interface::Write(uint8_t(Token));
 			interface::Write(uint8_t(response));
 		}
@@ -148,8 +185,12 @@ namespace MkII
 		void PollInterface()
 		{
 			uint8_t ch;
-			if(interface::Getch(ch))
+			if(!interface::Getch(ch))
+			{
+				// the last page is written while the host is quiet
+				StepPendingPage();
 				return;
+			}
 			
 			if(ch != MessageStart)
 				return;
@@ -163,8 +204,11 @@ namespace MkII
 
 			_header.messageId = interface::Read();
 		
+			// handlers consume exactly the message body
+			_rxTimeout = false;
 			ProcessCommand();
-			//uint16_t crc = interface::ReadU16();
+			if(!_rxTimeout)
+				interface::ReadU16(); // crc
 		}
 
 		void GetParameter()
@@ -212,6 +256,9 @@ namespace MkII
 	 			case PDI_FlashBootOffset:
 					ParamResponse<uint32_t>(_params.PDI_FlashBootOffset);
 					break;
+				case CompareBeforeWrite:
+					ParamResponse<uint8_t>(_params.CompareBeforeWrite);
+					break;
 
 				default:
 					//IO::Portb::Write(parameter);
@@ -259,14 +306,20 @@ namespace MkII
 				case RunAfterProgramming:
 					_params.RunAfterProgramming = interface::Read();
 					break;
+				case CompareBeforeWrite:
+					_params.CompareBeforeWrite = interface::Read();
+					break;
 
 				case AllowPageProgrammingInScanChain:
+					interface::Read();
 					break;
 				case BaudRate:
+					interface::Read();
 					//SetBaund(); //does not work correctly
 					break;
 				default:
 					//IO::Portb::Write(parameter);
+					SkipMessage(2);
 					SendResponse(RSP_ILLEGAL_PARAMETER);
 					return;
 			}
@@ -291,6 +344,13 @@ namespace MkII
 		void ProcessCommand()
 		{
 			//IO::Portb::Write(_header.messageId);
+			// failure of a buffered page write is reported on the next command
+			if(_header.messageId != CMND_WRITE_MEMORY && !FinishPendingPage())
+			{
+				SkipMessage();
+				SendResponse(RSP_FAILED);
+				return;
+			}
 			switch(_header.messageId)
 			{
 				case CMND_SIGN_OFF:
@@ -326,12 +386,17 @@ namespace MkII
 				break;
 
 				case CMND_READ_MEMORY:
-					ReadMemBuffered();
-					//ReadMemStreamed();
+					ReadMemStreamed();
 				break;
 				
 				case CMND_SET_DEVICE_DESCRIPTOR:
-					interface::Read(&_deviceDescriptor, sizeof(_deviceDescriptor));
+					if(_header.messageLen - 1 >= sizeof(_deviceDescriptor))
+					{
+						interface::Read(&_deviceDescriptor, sizeof(_deviceDescriptor));
+						SkipMessage(1 + sizeof(_deviceDescriptor));
+					}
+					else
+						SkipMessage();
 					SendResponse(RSP_OK);
 				break;
 				case CMND_CLEAR_EVENTS:
@@ -342,6 +407,10 @@ namespace MkII
 					Erase();
 				break;
 
+				case CMND_XMEGA_CRC:
+					Crc();
+				break;
+
 				case CMND_WRITE_PC:
 				case CMND_READ_PC:
 				case CMND_GO:
@@ -367,56 +436,207 @@ namespace MkII
 
 				default:
 					//IO::Portb::Write(_header.messageId);
+					SkipMessage();
 					SendResponse(RSP_ILLEGAL_COMMAND);
 			}
 		}
 
+		// Skips the rest of message body, consumed is the number of bytes already read including command id
+		void SkipMessage(uint32_t consumed = 1)
+		{
+			for(uint32_t i = consumed; i < _header.messageLen; i++)
+				interface::Read();
+		}
+
+		bool IsPaged(uint8_t memType)
+		{
+			return memType == XMEGA_APPLICATION_FLASH || 
+				memType == XMEGA_BOOT_FLASH || 
+				memType == EEPROM;
+		}
+
+		// Flash and EEPROM pages are double buffered: a page is received into one buffer
+		// while the previous one is loaded to the target and written from the other.
+		// Host data goes first, page data and NVM busy polls go over PDI in the gaps.
+		// The reply is sent when the page is received and the previous page is written,
+		// so it carries the result of the previous page. Holding it back until then keeps
+		// a pipelining host from overrunning the RX queue while the NVM controller is busy.
+		// The last page is written while the host is quiet, any other command waits for it
+		// and is answered RSP_FAILED, without being executed, if it failed.
+		// Blank and unchanged pages are found in the received data, before any target access.
+		// If the host stops sending in the middle of the data (about 0.1 s at 16 MHz),
+		// the page is dropped and RSP_FAILED is sent without waiting for the frame CRC.
 		void WriteMem()
 		{
 			uint8_t memType = interface::Read();
 			uint32_t size = interface::ReadU32();
 			uint32_t address = interface::ReadU32();
 
-			if(size > _pageBuffer.Size())
+			if(size > _pageBuffer[0].Size())
 			{
-				SendResponse(RSP_ILLEGAL_MEMORY_RANGE);
+				SkipMessage(10);
+				SendResponse(FinishPendingPage() ? RSP_ILLEGAL_MEMORY_RANGE : RSP_FAILED);
 				return;
 			}
-			
-			interface::Read(_pageBuffer, size);
 
-			if(!_target->WriteMem(memType, _pageBuffer, size, address))
+			uint8_t *buffer = _pageBuffer[_pending.buffer ^ 1];
+			uint16_t received = 0, idle = 0;
+			while(received < size)
+			{
+				uint8_t c;
+				if(interface::Getch(c))
+				{
+					buffer[received++] = c;
+					idle = 0;
+				}
+				else if(!StepPendingPage() && ++idle == 0)
+					break;
+			}
+			bool ok = FinishPendingPage();
+
+			if(received < size)
+			{
+				_rxTimeout = true;
 				SendResponse(RSP_FAILED);
-			SendResponse(RSP_OK);
+				return;
+			}
+
+			if(!IsPaged(memType))
+				ok = _target->WriteMem(memType, buffer, size, address) && ok;
+			// blank and unchanged pages are acknowledged without programming
+			else if(size && _target->PageWriteNeeded(memType, buffer, size, address))
+			{
+				_pending.buffer ^= 1;
+				_pending.memType = memType;
+				_pending.size = size;
+				_pending.address = address;
+				_pending.state = PageBegin;
+			}
+			SendResponse(ok ? RSP_OK : RSP_FAILED);
+		}
+
+		// One step of the pending page write: a page data byte, an NVM busy poll or
+		// the up to 21 PDI bytes that start a page load or write. Steps run when the RX
+		// queue is empty and have to end before 32 host bytes fill it: the PDI clock must be
+		// above 3/4 of the host baud rate (software PDI 50 kHz, host link 19200 baud).
+		// Returns false if there is nothing to do.
+		bool StepPendingPage()
+		{
+			switch(_pending.state)
+			{
+				case PageBegin:
+					_pending.loaded = 0;
+					if(_target->BeginPageLoad(_pending.memType, _pending.size, _pending.address))
+						_pending.state = PageLoad;
+					else
+						PageFailed();
+					return true;
+				case PageLoad:
+					PageData(_pageBuffer[_pending.buffer][_pending.loaded++]);
+					if(_pending.loaded == _pending.size)
+						_pending.state = PageCommit;
+					return true;
+				case PageCommit:
+					_pending.polls = 0;
+					if(_target->CommitPage(_pending.memType, _pending.address))
+						_pending.state = PageBusy;
+					else
+						PageFailed();
+					return true;
+				case PageBusy:
+					if(!_target->NvmBusy())
+						_pending.state = PageNone;
+					else if(++_pending.polls == MaxBusyPolls)
+						PageFailed();
+					return true;
+				default:
+					return false;
+			}
 		}
 
-		void ReadMemBuffered()
+		void PageFailed()
+		{
+			_pending.state = PageNone;
+			_pagesOk = false;
+		}
+
+		// Completes the pending page, false if a page failed since the last call
+		bool FinishPendingPage()
+		{
+			while(StepPendingPage());
+			bool ok = _pagesOk;
+			_pagesOk = true;
+			return ok;
+		}
+
+		// Per byte call of the page load loop, bound statically for the PDI target
+		void PageData(uint8_t c)
+		{
+			if(_target == &_xmega)
+				_xmega.PageData(c);
+			else
+				_target->PageData(c);
+		}
+
+		// Per chunk call of the streamed read, bound statically for the PDI target
+		void ReadData(uint8_t *buffer, uint8_t size)
+		{
+			if(_target == &_xmega)
+				_xmega.ReadData(buffer, size);
+			else
+				_target->ReadData(buffer, size);
+		}
+
+		// Size is not limited by the page buffer: the target is set up once for the whole
+		// block and the data goes to the host in chunks. An unsupported memory type is
+		// reported as RSP_FAILED. If the target is lost while the data is read, the frame
+		// is ended with a broken CRC, so the host drops it instead of taking the data.
+		void ReadMemStreamed()
 		{
 			uint8_t memType = interface::Read();
 			uint32_t size = interface::ReadU32();
 			uint32_t address = interface::ReadU32();
-			Int32 i;
-			i.Dword = address;
-			//IO::Portb::Write(memType);
-			//IO::Portb::Write(size>>8);
-			//IO::Portb::Write(i.Bytes[0]);
-			if(size > _pageBuffer.Size())
+
+			if(size == 0)
 			{
 				SendResponse(RSP_ILLEGAL_MEMORY_RANGE);
 				return;
 			}
 
-			if(_target->ReadMem(memType, _pageBuffer, size, address))
+			if(!_target->BeginRead(memType, size, address))
+			{
+				SendResponse(RSP_FAILED);
+				return;
+			}
+
+			SendMessageHeader(size+1, RSP_MEMORY);
+			while(size)
 			{
-				SendMessageHeader(size+1, RSP_MEMORY);
-				interface::Write(_pageBuffer, size);
+				uint8_t chunk = size > ReadChunkSize ? ReadChunkSize : size;
+				ReadData(_pageBuffer[0], chunk);
+				interface::Write(_pageBuffer[0], chunk);
+				size -= chunk;
+			}
+			if(_target->EndRead())
+				interface::EndTxFrame();
+			else
+				interface::AbortTxFrame();
+		}
+
+		void Crc()
+		{
+			uint8_t section = interface::Read();
+			uint32_t crc;
+			if(_target->Crc(section, crc))
+			{
+				SendMessageHeader(4, RSP_MEMORY);
+				interface::Write(&crc, 3);
 				interface::EndTxFrame();
 			}
 			else
 			{
 				SendResponse(RSP_FAILED);
 			}
-			
 		}
 
 		void Erase()
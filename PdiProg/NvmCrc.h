@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+
+namespace XMega
+{
+	// CRC calculated by XMega NVM controller commands CMD_APPCRC, CMD_BOOTCRC and CMD_FLASHCRC,
+	// 24 bit result is read from NVM DATA0..DATA2.
+	// Generator polynomial of XMega A manual: x^24 + x^4 + x^3 + x + 1,
+	// zero initial value, bits are shifted in MSB first, bytes in address order.
+	// Section CRC covers the whole section: pad image with 0xff to the section size
+	// with NvmCrcFill() before comparing.
+	enum
+	{
+		NvmCrcPoly = 0x00001bul,
+		NvmCrcMask = 0xfffffful
+	};
+
+	inline uint32_t NvmCrcUpdate(uint32_t crc, uint8_t c)
+	{
+		crc ^= uint32_t(c) << 16;
+		for(uint8_t i = 0; i < 8; i++)
+		{
+			if(crc & 0x800000ul)
+				crc = (crc << 1) ^ NvmCrcPoly;
+			else
+				crc <<= 1;
+		}
+		return crc & NvmCrcMask;
+	}
+
+	inline uint32_t NvmCrc(const uint8_t *data, uint32_t size, uint32_t crc = 0)
+	{
+		for(uint32_t i = 0; i < size; i++)
+			crc = NvmCrcUpdate(crc, data[i]);
+		return crc;
+	}
+
+	inline uint32_t NvmCrcFill(uint32_t crc, uint8_t c, uint32_t count)
+	{
+		for(; count; count--)
+			crc = NvmCrcUpdate(crc, c);
+		return crc;
+	}
+}
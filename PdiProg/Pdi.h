@@ -2,38 +2,11 @@
 #include <util/delay.h>
 #include "util.h"
 #include "ProgInterface.h"
+#include "PdiCommands.h"
 #include "timer.h"
 
 namespace Pdi
 {
-	enum
-	{
-		CMD_LDS               = 0x00,
-		CMD_LD                = 0x20,
-		CMD_STS               = 0x40,
-		CMD_ST                = 0x60,
-		CMD_LDCS              = 0x80,
-		CMD_REPEAT            = 0xA0,
-		CMD_STCS              = 0xC0,
-		CMD_KEY               = 0xE0,
-
-		STATUS_REG            = 0x0,
-		RESET_REG             = 0x1,
-		CTRL_REG              = 0x2,
-
-		STATUS_NVM            = 0x02,
-		RESET_KEY             = 0x59,
-
-		DATSIZE_1BYTE         = 0x0,
-		DATSIZE_2BYTES        = 0x1,
-		DATSIZE_3BYTES        = 0x2,
-		DATSIZE_4BYTES        = 0x3,
-
-		POINTER_INDIRECT      = 0x0,
-		POINTER_INDIRECT_PI   = 0x1,
-		POINTER_DIRECT        = 0x2
-	};
-
 	struct PdiSoftwareData
 	{
 		uint16_t data;
@@ -107,6 +80,18 @@ namespace Pdi
 			return (uint8_t)_data.data;
 		}
 
+		void WriteBlock(const uint8_t *data, size_t size)
+		{
+			for(size_t i=0; i<size; ++i)
+				PdiSoftwarePhisical::WriteByte(data[i]);
+		}
+
+		void ReadBlock(uint8_t *data, size_t size)
+		{
+			for(size_t i=0; i<size; ++i)
+				data[i] = PdiSoftwarePhisical::ReadByte();
+		}
+
 		void Reset()
 		{
 			DataPin::Clear();
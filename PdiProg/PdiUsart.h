@@ -0,0 +1,198 @@
+#pragma once
+#include <avr/io.h>
+#include <util/delay.h>
+#include "util.h"
+#include "static_assert.h"
+#include "usart.h"
+#include "ProgInterface.h"
+
+namespace Pdi
+{
+	// USART registers for PDI. The USART runs in synchronous master mode,
+	// XCK drives PDI_CLK, TXD and RXD are tied together to PDI_DATA (TXD through a resistor).
+	// 8 data bits, even parity, 2 stop bits, data changes on falling and sampled on rising XCK edge.
+	#define DECLARE_PDI_USART(CLASS_NAME, _UDR_, _UCSRA_, _UCSRB_, _UCSRC_, _UBRRL_, _UBRRH_)\
+	struct CLASS_NAME\
+	{\
+		static inline void Init(uint16_t ubrr)\
+		{\
+			_UCSRB_ = 0;\
+			_UCSRA_ = 0;\
+			_UBRRH_ = ubrr >> 8;\
+			_UBRRL_ = ubrr;\
+			_UCSRC_ = ursel | (1 << UMSEL) | (1 << UPM1) | (1 << USBS) | (1 << UCSZ1) | (1 << UCSZ0) | (1 << UCPOL);\
+		}\
+		static inline void Disable()\
+		{\
+			_UCSRB_ = 0;\
+		}\
+		static inline void SetTxMode()\
+		{\
+			_UCSRB_ = (1 << TXEN);\
+		}\
+		static inline void SetRxMode()\
+		{\
+			_UCSRB_ = (1 << RXEN);\
+		}\
+		static inline void Write(uint8_t value)\
+		{\
+			while(!(_UCSRA_ & (1 << UDRE)));\
+			_UCSRA_ = (1 << TXC);\
+			_UDR_ = value;\
+		}\
+		static inline void WaitTxComplete()\
+		{\
+			while(!(_UCSRA_ & (1 << TXC)));\
+		}\
+		static inline uint8_t Read()\
+		{\
+			while(!(_UCSRA_ & (1 << RXC)));\
+			return _UDR_;\
+		}\
+	};
+
+#ifdef UDR
+	DECLARE_PDI_USART(PdiUsartRegs, UDR, UCSRA, UCSRB, UCSRC, UBRRL, UBRRH)
+#endif
+
+#ifdef UDR0
+	DECLARE_PDI_USART(PdiUsart0Regs, UDR0, UCSR0A, UCSR0B, UCSR0C, UBRR0L, UBRR0H)
+#endif
+
+#ifdef UDR1
+	DECLARE_PDI_USART(PdiUsart1Regs, UDR1, UCSR1A, UCSR1B, UCSR1C, UBRR1L, UBRR1H)
+#endif
+
+	// Hardware PDI physical layer, drop-in replacement of PdiSoftwarePhisical.
+	// Frames are shifted by the USART, no timer interrupt is used and the CPU only
+	// waits for the data register, so the PDI clock can go up to F_CPU/2 (PDI allows up to 10 MHz).
+	// Pins are the XCK and TXD pins of the USART.
+	// Not used by PdiProg main: the only USART of mega16 carries the host link (CommInterface),
+	// PDI can take a USART on a part with two of them or once the host link is on USB.
+	template<class Regs, class ClockPin, class DataPin, unsigned long ClockFreq = 1000000>
+	class PdiUsartPhisical :public ProgInterface
+	{
+		BOOST_STATIC_ASSERT(ClockFreq <= F_CPU / 2 && ClockFreq <= 10000000);
+		enum {Ubrr = F_CPU / 2 / ClockFreq - 1};
+		public:
+		enum {FrameLength = 12};
+
+		void Enable()
+		{
+			ClockPin::SetDirWrite();
+			DataPin::SetDirWrite();
+			DataPin::Set();
+			_delay_us(1);
+			Regs::Init(Ubrr);
+			WriteMode();
+			Break();
+			Break();
+		}
+
+		void Disable()
+		{
+			FlushTx();
+			Regs::Disable();
+			DataPin::Clear();
+			DataPin::SetDirRead();
+			ClockPin::SetDirRead();
+		}
+
+		void WriteByte(uint8_t c)
+		{
+			if(!_isSending)
+				WriteMode();
+			Regs::Write(c);
+			_txPending = true;
+		}
+
+		uint8_t ReadByte()
+		{
+			if(_isSending)
+				ReadMode();
+			return Regs::Read();
+		}
+
+		void WriteBlock(const uint8_t *data, size_t size)
+		{
+			if(!size)
+				return;
+			if(!_isSending)
+				WriteMode();
+			for(size_t i=0; i<size; ++i)
+				Regs::Write(data[i]);
+			_txPending = true;
+		}
+
+		void ReadBlock(uint8_t *data, size_t size)
+		{
+			if(_isSending)
+				ReadMode();
+			for(size_t i=0; i<size; ++i)
+				data[i] = Regs::Read();
+		}
+
+		void Reset()
+		{
+			Regs::Disable();
+			_isSending = false;
+			_txPending = false;
+			DataPin::Clear();
+			DataPin::SetDirRead();
+			ClockPin::SetDirWrite();
+			ClockPin::Set();
+			_delay_ms(10);
+			ClockPin::Clear();
+			_delay_us(10);
+			ClockPin::Set();
+		}
+
+		// IDLE frame as in PdiSoftwarePhisical: the transmitter keeps the line high
+		// while XCK is running, so it is enough to wait for one frame time.
+		void Break()
+		{
+			if(_isSending)
+				FlushTx();
+			else
+				WriteMode();
+			_delay_us(FrameLength * 1000000.0 / ClockFreq + 1);
+		}
+
+	protected:
+		static void WriteMode()
+		{
+			DataPin::Set();
+			DataPin::SetDirWrite();
+			Regs::SetTxMode();
+			_isSending = true;
+		}
+
+		static void ReadMode()
+		{
+			// last frame must leave the shift register before the line is released
+			FlushTx();
+			Regs::SetRxMode();
+			DataPin::SetDirRead();
+			DataPin::Clear();
+			_isSending = false;
+		}
+
+		static void FlushTx()
+		{
+			if(_txPending)
+			{
+				Regs::WaitTxComplete();
+				_txPending = false;
+			}
+		}
+
+		static bool _isSending;
+		static bool _txPending;
+	};
+
+	template<class Regs, class ClockPin, class DataPin, unsigned long ClockFreq>
+	bool PdiUsartPhisical<Regs, ClockPin, DataPin, ClockFreq>::_isSending;
+
+	template<class Regs, class ClockPin, class DataPin, unsigned long ClockFreq>
+	bool PdiUsartPhisical<Regs, ClockPin, DataPin, ClockFreq>::_txPending;
+}
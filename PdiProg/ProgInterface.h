@@ -1,4 +1,7 @@
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "util.h"
 
 class ProgInterface
 {
@@ -9,6 +12,19 @@ public:
 	virtual uint8_t ReadByte()=0;
 	virtual void Reset()=0;
 	virtual void Break()=0;
+
+	// Block transfers, physical layers override them with a loop without virtual calls per byte
+	virtual void WriteBlock(const uint8_t *data, size_t size)
+	{
+		for(size_t i=0; i<size; ++i)
+			WriteByte(data[i]);
+	}
+
+	virtual void ReadBlock(uint8_t *data, size_t size)
+	{
+		for(size_t i=0; i<size; ++i)
+			data[i] = ReadByte();
+	}
 	
 	template<class T>
 	void Write(const T &value)
@@ -37,8 +53,7 @@ public:
 
 	void Write(const uint8_t *value, const size_t size)
 	{
-		for(uint8_t i=0; i<size; ++i)
-			this->WriteByte(value[i]);
+		WriteBlock(value, size);
 	}
 
 	template<class T>
@@ -52,10 +67,45 @@ public:
 
 	void Read(void *value, const size_t size)
 	{
-		uint8_t * data = reinterpret_cast<uint8_t*>(value);
-		for(uint8_t i=0; i<size; ++i)
-			data[i] = this->ReadByte();
+		ReadBlock(reinterpret_cast<uint8_t*>(value), size);
+	}
+};
+
+// Non-virtual access to a physical layer of known type. Calls are bound
+// at compile time and can be inlined, byte loops of a target driver
+// do not pay for an indirect call per byte.
+template<class Phy>
+class StaticProgInterface
+{
+public:
+	StaticProgInterface(Phy *phy)
+		:_phy(phy)
+	{}
+
+	void Enable(){_phy->Phy::Enable();}
+	void Disable(){_phy->Phy::Disable();}
+	void WriteByte(uint8_t c){_phy->Phy::WriteByte(c);}
+	uint8_t ReadByte(){return _phy->Phy::ReadByte();}
+	void Reset(){_phy->Phy::Reset();}
+	void Break(){_phy->Phy::Break();}
+
+	template<class T>
+	void Write(const T &value)
+	{
+		_phy->Phy::WriteBlock(reinterpret_cast<const uint8_t *>(&value), sizeof(T));
+	}
+
+	void Write(const uint8_t *value, const size_t size)
+	{
+		_phy->Phy::WriteBlock(value, size);
+	}
+
+	void Read(void *value, const size_t size)
+	{
+		_phy->Phy::ReadBlock(reinterpret_cast<uint8_t*>(value), size);
 	}
+private:
+	Phy *_phy;
 };
 
 class NullProgInterface :public ProgInterface
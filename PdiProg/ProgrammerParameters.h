@@ -25,4 +25,5 @@ struct ProgParameters
 	uint32_t PDI_FlashOffset;
 	uint32_t PDI_FlashBootOffset;
 	uint8_t RunAfterProgramming;
+	uint8_t CompareBeforeWrite;
 };
@@ -22,6 +22,34 @@ public:
 	virtual bool ReadMem(uint8_t memType, uint8_t *buffer, uint32_t size, uint32_t address) = 0;
 	virtual bool WriteMem(uint8_t memType, uint8_t *buffer, uint32_t size, uint32_t address) = 0;
 	virtual bool Erase(uint8_t memType, uint32_t address)= 0;
+	virtual bool Crc(uint8_t section, uint32_t &crc) = 0;
+
+	// Paged write in steps, lets the caller overlap page transfer and programming with other work:
+	// BeginPageLoad(), size times PageData(), CommitPage() starts the write,
+	// NvmBusy() is polled until it is complete.
+	// BeginPageLoad() returns false for memory types that are not paged.
+	// WriteMem() and Erase() return when the NVM operation is complete.
+	virtual bool BeginPageLoad(uint8_t memType, uint32_t size, uint32_t address) = 0;
+	virtual bool CommitPage(uint8_t memType, uint32_t address) = 0;
+	virtual bool NvmBusy() = 0;
+	// False if the page already holds the data and writing it can be skipped
+	virtual bool PageWriteNeeded(uint8_t memType, const uint8_t *data, uint32_t size, uint32_t address) = 0;
+
+	// Streamed read in steps with one setup for the whole block:
+	// BeginRead(), ReadData() for consecutive parts of size bytes, EndRead().
+	// EndRead() returns false if the target was lost while the data was read.
+	virtual bool BeginRead(uint8_t memType, uint32_t size, uint32_t address) = 0;
+	virtual bool EndRead() = 0;
+
+	void PageData(uint8_t c)
+	{
+		_progIface->WriteByte(c);
+	}
+
+	void ReadData(uint8_t *buffer, uint8_t size)
+	{
+		_progIface->ReadBlock(buffer, size);
+	}
 protected:
 	ProgInterface *_progIface;
 	DeviceDescriptor *_deviceDescriptor;
@@ -57,4 +85,39 @@ public:
 	{
 		return false;
 	}
+
+	virtual bool Crc(uint8_t section, uint32_t &crc)
+	{
+		return false;
+	}
+
+	virtual bool BeginPageLoad(uint8_t memType, uint32_t size, uint32_t address)
+	{
+		return false;
+	}
+
+	virtual bool CommitPage(uint8_t memType, uint32_t address)
+	{
+		return false;
+	}
+
+	virtual bool NvmBusy()
+	{
+		return false;
+	}
+
+	virtual bool PageWriteNeeded(uint8_t memType, const uint8_t *data, uint32_t size, uint32_t address)
+	{
+		return true;
+	}
+
+	virtual bool BeginRead(uint8_t memType, uint32_t size, uint32_t address)
+	{
+		return false;
+	}
+
+	virtual bool EndRead()
+	{
+		return false;
+	}
 };
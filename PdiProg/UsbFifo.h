@@ -1,60 +1,71 @@
 #pragma once
 #include "usbdrvCpp.h"
 
+// HwInterface over V-USB interrupt endpoints.
+// TX bytes are queued and chained into the interrupt-in endpoint from Poll():
+// full packets as soon as they are queued, the tail once the frame is complete.
+// The queue holds a streamed RSP_MEMORY chunk with its frame header, so the
+// protocol does not wait for the host while the reply goes out.
+// RX is flow controlled: host packets are NAKed while the queue can not take
+// a whole packet, so large host writes are not dropped.
 class UsbFifo
 {
-	enum {UsbPacketSize = 8};
-	static uint8_t FlushTx()
+	enum {UsbPacketSize = 8, TxQueueSize = 64, RxQueueSize = 32};
+
+	// One slot of each queue is kept free: Count() of a full queue reads 0
+	static uint8_t RxSpace()
 	{
-		if(Usb::InterruptIsReady())
-		{
-			Usb::usbSetInterrupt(_txBuf, _txCount);
-			_txCount = 0;
-			return 1;
-		}
-		else return 0;
+		return RxQueueSize - 1 - _rxBuf.Count();
 	}
 public:
 
+	// Runs the USB driver and sends the next packet when the endpoint is free
+	static void Poll()
+	{
+		Usb::usbPoll();
+		if(!Usb::InterruptIsReady())
+			return;
+		uint8_t count = _txBuf.Count();
+		if(count >= UsbPacketSize)
+			Usb::SetStreamData(_txBuf, UsbPacketSize);
+		else if(count && _flush)
+			Usb::SetStreamData(_txBuf, count);
+		if(!_txBuf.Count())
+			_flush = false;
+	}
+
 	static uint8_t Putch(uint8_t c)
 	{
-		if(_txCount < UsbPacketSize)
+		if(_txBuf.Count() >= TxQueueSize - 1)
 		{
-			_txBuf[_txCount++] = c;
-			if(_txCount == UsbPacketSize)
-			{
-				return FlushTx();
-			}
-		}else
-		{
-			if(!FlushTx())
-				return 0;
-			_txBuf[_txCount++] = c;
+			Poll();
+			return 0;
 		}
+		_txBuf.Write(c);
+		return 1;
 	}
 
-	static void Getch(uint8_t &c)
+	static uint8_t Getch(uint8_t &c)
 	{
-		while(!_rxBuf.Read(c))
+		if(!_rxBuf.Read(c))
 		{
-			Usb::usbPoll();
+			Poll();
+			return 0;
 		}
-//		Debug.Putch('R');
-//		Debug.Putch(c);
-//		Debug.Putch(' ');
+		if(Usb::RxIsDisabled() && RxSpace() >= UsbPacketSize)
+			Usb::EnableRx();
+		return 1;
 	}
 
 	static void BeginTxFrame()
 	{
-		//Usb::usbSetInterrupt(0, 0);
 	}
 
+	// Does not wait for the host, the tail packet is sent from Poll()
 	static void EndTxFrame()
 	{
-		do
-		{
-			Usb::usbPoll();
-		}while(!FlushTx());
+		_flush = true;
+		Poll();
 	}
 
 	static void BeginRx()
@@ -69,26 +80,26 @@ public:
 
 	static void RxCallBack(uint8_t *data, uint8_t len)
 	{
-		for(uint8_t i=0; i < len; i++)
+		for(uint8_t i=0; i < len && RxSpace(); i++)
 		{
 			_rxBuf.Write(data[i]);
-//			Debug.Putch(data[i]);
 		}
+		if(RxSpace() < UsbPacketSize)
+			Usb::DisableRx();
 	}
 
 protected:
-	static Queue<16> _rxBuf;
-	static Array<8> _txBuf;
-	static uint8_t _txCount;
+	static Queue<RxQueueSize> _rxBuf;
+	static Queue<TxQueueSize> _txBuf;
+	static bool _flush;
 };
 
-	Queue<16> UsbFifo::_rxBuf;
-	Array<8> UsbFifo::_txBuf;
-	uint8_t UsbFifo::_txCount = 0;
+	Queue<UsbFifo::RxQueueSize> UsbFifo::_rxBuf;
+	Queue<UsbFifo::TxQueueSize> UsbFifo::_txBuf;
+	bool UsbFifo::_flush = false;
 
 
 extern "C" void usbFunctionWriteOut(uint8_t *data, uint8_t len)
 {
-//	Debug << len << "\r\n";
 	UsbFifo::RxCallBack(data, len);
 }
@@ -44,7 +44,9 @@
 		CMND_JTAG_SAB_READ = 0x29,
 		CMND_JTAG_BLOCK_READ = 0x2C,
 		CMND_JTAG_BLOCK_WRITE = 0x2D,
-		CMND_XMEGA_ERASE  = 0x34
+		CMND_XMEGA_ERASE  = 0x34,
+		// not in MkII protocol, extension of this programmer
+		CMND_XMEGA_CRC  = 0x70
 	};
 	
 	enum Responses
@@ -130,6 +132,14 @@
 		XMEGA_ERASE_USERSIG = 0x07
 	};
 
+	// CMND_XMEGA_CRC section, result is 24 bit CRC in RSP_MEMORY, see NvmCrc.h
+	enum XMegaCrcSection
+	{
+		XMEGA_CRC_FLASH = 0x00,
+		XMEGA_CRC_APP = 0x01,
+		XMEGA_CRC_BOOT = 0x02
+	};
+
 	enum Parameters
 	{
 		HardwareVersion = 0x01,
@@ -151,7 +161,10 @@
 		DaisyChainInfo = 0x1B,
 		ExternalReset = 0x13,
 		AllowPageProgrammingInScanChain = 0x24,
-		RunAfterProgramming = 0x38
+		RunAfterProgramming = 0x38,
+		// not in MkII protocol, extension of this programmer:
+		// 1 - compare flash/EEPROM pages with target and write changed pages only
+		CompareBeforeWrite = 0x70
 	};
 
 	enum EmulatorMode
@@ -131,6 +131,22 @@ namespace Usb
 		return (usbTxStatus1.len & 0x10);
 	}
 
+	// OUT flow control: while disabled the driver answers host data with NAK
+	inline void DisableRx()
+	{
+		usbDisableAllRequests();
+	}
+
+	inline void EnableRx()
+	{
+		usbEnableAllRequests();
+	}
+
+	inline bool RxIsDisabled()
+	{
+		return usbAllRequestsAreDisabled();
+	}
+
 }
 
 #define STRING_DESCRIPTOR(name, value) \
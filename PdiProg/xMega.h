@@ -3,7 +3,7 @@
 #include "TargetDeviceCtrl.h"
 #include "ProgInterface.h"
 #include "constants.h"
-#include "Pdi.h"
+#include "PdiCommands.h"
 
 namespace XMega
 {
@@ -61,36 +61,53 @@ namespace XMega
 		REG_LOCKBITS               = 0x10
 	};
 
-	template<class Comm>
+	// PdiPhy is the concrete PDI physical layer. All PDI traffic goes through it
+	// with static dispatch, virtual TargetDeviceCtrl methods are entered once per command.
+	template<class Comm, class PdiPhy>
 	class Xmega :public TargetDeviceCtrl
 	{
+		// Paged sections, tracked for blank page skipping
+		enum Section
+		{
+			SectionApp,
+			SectionBoot,
+			SectionEeprom,
+			SectionsCount,
+			SectionNone = SectionsCount
+		};
 		public:
 		
-		Xmega(ProgParameters *progParams, DeviceDescriptor *deviceDescroptor)
-			:TargetDeviceCtrl(progParams, deviceDescroptor)
+		Xmega(PdiPhy *pdi, ProgParameters *progParams, DeviceDescriptor *deviceDescroptor)
+			:TargetDeviceCtrl(progParams, deviceDescroptor),
+			_pdi(pdi)
 		{
 			_progParams->PDI_NVM_Offset = 0x010001C0;
+			ForgetErased();
 		}
 
 		virtual void EnterProgMode()
 		{
-			_progIface->Enable();
-			_progIface->WriteByte(Pdi::CMD_STCS | Pdi::RESET_REG);	
-			_progIface->WriteByte(Pdi::RESET_KEY);
+			ForgetErased();
+			_pdi.Enable();
+			_pdi.WriteByte(Pdi::CMD_STCS | Pdi::RESET_REG);	
+			_pdi.WriteByte(Pdi::RESET_KEY);
 
-			_progIface->WriteByte(Pdi::CMD_STCS | Pdi::CTRL_REG);	
-			_progIface->WriteByte(0x05);
+			_pdi.WriteByte(Pdi::CMD_STCS | Pdi::CTRL_REG);	
+			_pdi.WriteByte(0x05);
 
-			_progIface->WriteByte(Pdi::CMD_KEY);
+			_pdi.WriteByte(Pdi::CMD_KEY);
 			long long key = 0x1289AB45CDD888FFll;
-			_progIface->Write(key);
+			_pdi.Write(key);
 		}
 
 		virtual void LeaveProgMode()
 		{
-			_progIface->WriteByte(Pdi::CMD_STCS | Pdi::RESET_REG);	
-			_progIface->WriteByte(0x00);
-			_progIface->Disable();
+			// an NVM operation that timed out may still be in progress
+			WaitWhileControllerBusy();
+			ForgetErased();
+			_pdi.WriteByte(Pdi::CMD_STCS | Pdi::RESET_REG);	
+			_pdi.WriteByte(0x00);
+			_pdi.Disable();
 		}
 
 		virtual uint32_t GetJTAGID()
@@ -99,6 +116,16 @@ namespace XMega
 		}
 
 		virtual bool ReadMem(uint8_t memType, uint8_t *buffer, uint32_t size, uint32_t address)
+		{
+			if(!BeginRead(memType, size, address))
+				return false;
+			_pdi.Read(buffer, size);
+			return EndRead();
+		}
+
+		// One LD instruction repeated over the whole block, the target sends
+		// the next byte when the programmer clocks it, so reads may pause between parts
+		virtual bool BeginRead(uint8_t memType, uint32_t size, uint32_t address)
 		{
 			if(!Command(CMD_READNVM))
 				return false;
@@ -107,39 +134,33 @@ namespace XMega
 		
 			SetRepeat(size - 1);
 
-			_progIface->WriteByte(Pdi::CMD_LD | (Pdi::POINTER_INDIRECT_PI << 2) | Pdi::DATSIZE_1BYTE);
-
-			for(uint32_t i=0; i<size; i++)
-			{
-				uint8_t c = _progIface->ReadByte();
-				buffer[i] = c;
-			}
-
+			_pdi.WriteByte(Pdi::CMD_LD | (Pdi::POINTER_INDIRECT_PI << 2) | Pdi::DATSIZE_1BYTE);
 			return true;
 		}
 
+		// A lost target reads as idle line (0xff), a reset one has NVM access disabled
+		virtual bool EndRead()
+		{
+			_pdi.WriteByte(Pdi::CMD_LDCS | Pdi::STATUS_REG);
+			return _pdi.ReadByte() == Pdi::STATUS_NVM;
+		}
+
 		virtual bool WriteMem(uint8_t memType, uint8_t *buffer, uint32_t size, uint32_t address)
 		{
 			switch(memType)
 			{
 				case FUSE_BITS:
-					return WriteTriggeredCommand(CMD_WRITEFUSE, address, *buffer);
+					return WriteTriggeredCommand(CMD_WRITEFUSE, address, *buffer) && WaitWhileControllerBusy();
 				case LOCK_BITS:
-					return WriteTriggeredCommand(CMD_WRITELOCK, address, *buffer);
+					return WriteTriggeredCommand(CMD_WRITELOCK, address, *buffer) && WaitWhileControllerBusy();
 
 				case XMEGA_APPLICATION_FLASH:
-					FillPageBuffer(CMD_LOADFLASHPAGEBUFF, buffer, size, address);
-
-					return WriteTriggeredCommand(CMD_ERASEFLASHPAGE, address) &&
-					 WriteTriggeredCommand(CMD_WRITEAPPSECPAGE, address);
-
 				case XMEGA_BOOT_FLASH:
-					FillPageBuffer(CMD_LOADFLASHPAGEBUFF, buffer, size, address);
-					return WriteTriggeredCommand(CMD_WRITEBOOTSECPAGE, address);
-
 				case EEPROM:
-					FillPageBuffer(CMD_LOADEEPROMPAGEBUFF, buffer, size, address);
-					return WriteTriggeredCommand(CMD_ERASEWRITEEEPROMPAGE, address);
+					if(!BeginPageLoad(memType, size, address))
+						return false;
+					_pdi.Write(buffer, size);
+					return CommitPage(memType, address) && WaitWhileControllerBusy();
 
 				case XMEGA_USER_SIGNATURE:
 				case XMEGA_CALIBRATION_SIGNATURE:
@@ -158,20 +179,37 @@ namespace XMega
 		}
 
 		virtual bool Erase(uint8_t memType, uint32_t address)
+		{
+			return StartErase(memType, address) && WaitWhileControllerBusy();
+		}
+
+		bool StartErase(uint8_t memType, uint32_t address)
 		{
 			uint8_t eraseCmd;
 			switch(memType)
 			{
 				case XMEGA_ERASE_CHIP:
-					return ActionTriggeredCommand(CMD_CHIPERASE);
+					// EEPROM may be preserved by EESAVE fuse
+					if(!ActionTriggeredCommand(CMD_CHIPERASE))
+						return false;
+					SetErased(SectionApp);
+					SetErased(SectionBoot);
+					return true;
 				case XMEGA_ERASE_APP:
-					eraseCmd = CMD_ERASEAPPSEC;
-					break;
+					if(!WriteTriggeredCommand(CMD_ERASEAPPSEC, address))
+						return false;
+					SetErased(SectionApp);
+					return true;
 				case XMEGA_ERASE_BOOT:
-					eraseCmd = CMD_ERASEBOOTSEC;
-					break;
+					if(!WriteTriggeredCommand(CMD_ERASEBOOTSEC, address))
+						return false;
+					SetErased(SectionBoot);
+					return true;
 				case XMEGA_ERASE_EEPROM:
-					eraseCmd = CMD_ERASEEEPROM;
+					if(!ActionTriggeredCommand(CMD_ERASEEEPROM))
+						return false;
+					SetErased(SectionEeprom);
+					return true;
 				case XMEGA_ERASE_APP_PAGE:
 					eraseCmd = CMD_ERASEAPPSECPAGE;
 					break;
@@ -189,10 +227,166 @@ namespace XMega
 			}
 			return WriteTriggeredCommand(eraseCmd, address);
 		}
+
+		// Section CRC calculated by the NVM controller, host side is in NvmCrc.h
+		virtual bool Crc(uint8_t section, uint32_t &crc)
+		{
+			uint8_t command;
+			switch(section)
+			{
+				case XMEGA_CRC_FLASH:
+					command = CMD_FLASHCRC;
+					break;
+				case XMEGA_CRC_APP:
+					command = CMD_APPCRC;
+					break;
+				case XMEGA_CRC_BOOT:
+					command = CMD_BOOTCRC;
+					break;
+				default:
+					return false;
+			}
+			if(!ActionTriggeredCommand(command) || !WaitWhileControllerBusy())
+				return false;
+
+			Int32 result;
+			result.Dword = 0;
+			_pdi.WriteByte(Pdi::CMD_LDS | (Pdi::DATSIZE_4BYTES << 2) | Pdi::DATSIZE_3BYTES);
+			_pdi.Write(uint32_t(XMega::REG_DAT0 | _progParams->PDI_NVM_Offset));
+			_pdi.Read(result.Bytes, 3);
+			crc = result.Dword;
+			return true;
+		}
+
+		virtual bool BeginPageLoad(uint8_t memType, uint32_t size, uint32_t address)
+		{
+			switch(memType)
+			{
+				case XMEGA_APPLICATION_FLASH:
+				case XMEGA_BOOT_FLASH:
+					return BeginFillPageBuffer(CMD_LOADFLASHPAGEBUFF, size, address);
+				case EEPROM:
+					return BeginFillPageBuffer(CMD_LOADEEPROMPAGEBUFF, size, address);
+				default:
+					return false;
+			}
+		}
+
+		// Returns as soon as the write is started: application pages are erased and written
+		// by one command, so no wait for the controller is needed in between
+		virtual bool CommitPage(uint8_t memType, uint32_t address)
+		{
+			switch(memType)
+			{
+				case XMEGA_APPLICATION_FLASH:
+					return WriteTriggeredCommand(CMD_ERASEWRITEAPPSECPAGE, address);
+				case XMEGA_BOOT_FLASH:
+					return WriteTriggeredCommand(CMD_WRITEBOOTSECPAGE, address);
+				case EEPROM:
+					return WriteTriggeredCommand(CMD_ERASEWRITEEEPROMPAGE, address);
+				default:
+					return false;
+			}
+		}
+
+		// One poll of the NVM controller, a lost target reads as busy
+		virtual bool NvmBusy()
+		{
+			return ControllerBusy();
+		}
+
+		// Blank pages are skipped in a section erased in this session unless
+		// something was written at or above the page, so sequential programming after
+		// erase does not touch them. In CompareBeforeWrite mode the page is read back
+		// and compared, unchanged pages are skipped.
+		virtual bool PageWriteNeeded(uint8_t memType, const uint8_t *data, uint32_t size, uint32_t address)
+		{
+			uint8_t section = GetSection(memType);
+			if(section == SectionNone || size == 0)
+				return true;
+
+			uint32_t end = address + size;
+			if(IsErased(section) && address >= _writtenEnd[section] && IsBlank(data, size))
+				return false;
+
+			if(_progParams->CompareBeforeWrite && PageEquals(data, size, address))
+				return false;
+
+			if(end > _writtenEnd[section])
+				_writtenEnd[section] = end;
+			return true;
+		}
+
+		// Hide TargetDeviceCtrl::PageData and ReadData for callers that know the target type
+		void PageData(uint8_t c)
+		{
+			_pdi.WriteByte(c);
+		}
+
+		void ReadData(uint8_t *buffer, uint8_t size)
+		{
+			_pdi.Read(buffer, size);
+		}
 	protected:
 
+		static uint8_t GetSection(uint8_t memType)
+		{
+			switch(memType)
+			{
+				case XMEGA_APPLICATION_FLASH:
+					return SectionApp;
+				case XMEGA_BOOT_FLASH:
+					return SectionBoot;
+				case EEPROM:
+					return SectionEeprom;
+				default:
+					return SectionNone;
+			}
+		}
+
+		static bool IsBlank(const uint8_t *data, uint32_t size)
+		{
+			for(uint32_t i = 0; i < size; i++)
+				if(data[i] != 0xff)
+					return false;
+			return true;
+		}
+
+		// Target data is compared as it arrives, no read buffer is needed
+		bool PageEquals(const uint8_t *data, uint32_t size, uint32_t address)
+		{
+			if(!Command(CMD_READNVM))
+				return false;
+			Address(Pdi::CMD_ST | (Pdi::POINTER_DIRECT << 2) | Pdi::DATSIZE_4BYTES, address);
+			SetRepeat(size - 1);
+			_pdi.WriteByte(Pdi::CMD_LD | (Pdi::POINTER_INDIRECT_PI << 2) | Pdi::DATSIZE_1BYTE);
+			bool equal = true;
+			for(uint32_t i = 0; i < size; i++)
+			{
+				if(_pdi.ReadByte() != data[i])
+					equal = false;
+			}
+			return equal;
+		}
+
+		void ForgetErased()
+		{
+			_erased = 0;
+		}
+
+		void SetErased(uint8_t section)
+		{
+			_erased |= 1 << section;
+			_writtenEnd[section] = 0;
+		}
 
-		bool FillPageBuffer(uint8_t bufferCommand, uint8_t *buffer, uint16_t size, uint32_t address)
+		bool IsErased(uint8_t section)
+		{
+			return _erased & (1 << section);
+		}
+
+		// Page buffer data bytes follow
+		bool BeginFillPageBuffer(uint8_t bufferCommand, uint32_t size, uint32_t address)
 		{
 			if (size)
 			{
@@ -203,9 +397,7 @@ namespace XMega
 
 				SetRepeat(size - 1);
 			
-				_progIface->WriteByte(Pdi::CMD_ST | (Pdi::POINTER_INDIRECT_PI << 2) | Pdi::DATSIZE_1BYTE);
-				for (uint16_t i = 0; i < size; i++)
-				  _progIface->WriteByte(*(buffer++));
+				_pdi.WriteByte(Pdi::CMD_ST | (Pdi::POINTER_INDIRECT_PI << 2) | Pdi::DATSIZE_1BYTE);
 			}
 			return true;
 		}
@@ -215,8 +407,8 @@ namespace XMega
 			uint16_t timeout=500;
 			while (timeout--)
 			{
-				_progIface->Write(Pdi::CMD_LDCS | Pdi::STATUS_REG);
-				if (_progIface->ReadByte() & Pdi::STATUS_NVM)
+				_pdi.WriteByte(Pdi::CMD_LDCS | Pdi::STATUS_REG);
+				if (_pdi.ReadByte() & Pdi::STATUS_NVM)
 				{
 					return true;
 				}
@@ -224,15 +416,13 @@ namespace XMega
 			return false;
 		}
 
+		// Chip erase takes tens of ms, that is thousands of polls at fast PDI clock
 		bool WaitWhileControllerBusy(void)
 		{
-			uint16_t timeout=500;
+			uint16_t timeout=50000;
 			while (timeout--)
 			{
-				_progIface->Write(Pdi::CMD_LDS | (Pdi::DATSIZE_4BYTES << 2));
-				_progIface->Write<uint32_t>(XMega::REG_STATUS | _progParams->PDI_NVM_Offset);
-
-				if(!(_progIface->ReadByte() & (1 << 7)))
+				if(!ControllerBusy())
 				{
 					return true;
 				}
@@ -240,6 +430,13 @@ namespace XMega
 			return false;
 		}
 
+		bool ControllerBusy()
+		{
+			_pdi.WriteByte(Pdi::CMD_LDS | (Pdi::DATSIZE_4BYTES << 2));
+			_pdi.Write(uint32_t(XMega::REG_STATUS | _progParams->PDI_NVM_Offset));
+			return _pdi.ReadByte() & (1 << 7);
+		}
+
 		bool Command(uint8_t command)
 		{
 			return WriteNvmReg(REG_CMD, command);
@@ -247,7 +444,7 @@ namespace XMega
 
 		bool WriteTriggeredCommand(uint8_t command, uint32_t address, uint8_t value=0)
 		{
-			if(WriteNvmReg(REG_CMD, command))
+			if(!WriteNvmReg(REG_CMD, command))
 				return false;
 			Address(Pdi::CMD_STS | (Pdi::DATSIZE_4BYTES << 2), address, value);
 			return true;
@@ -281,20 +478,38 @@ namespace XMega
 
 		void Address(uint8_t command, uint32_t address)
 		{
-			_progIface->WriteByte(command);
-			_progIface->Write(address);
+			_pdi.WriteByte(command);
+			_pdi.Write(address);
 		}
 
 		void Address(uint8_t command, uint32_t address, uint8_t value)
 		{
 			Address(command, address);
-			_progIface->WriteByte(value);
+			_pdi.WriteByte(value);
 		}
 
-		void SetRepeat(uint8_t value)
+		// Next instruction is repeated value + 1 times, count size is the smallest that fits
+		void SetRepeat(uint32_t value)
 		{
-			_progIface->WriteByte(Pdi::CMD_REPEAT | Pdi::DATSIZE_1BYTE);
-			_progIface->WriteByte(value);
+			if(value <= 0xff)
+			{
+				_pdi.WriteByte(Pdi::CMD_REPEAT | Pdi::DATSIZE_1BYTE);
+				_pdi.WriteByte(uint8_t(value));
+			}
+			else if(value <= 0xffff)
+			{
+				_pdi.WriteByte(Pdi::CMD_REPEAT | Pdi::DATSIZE_2BYTES);
+				_pdi.Write(uint16_t(value));
+			}
+			else
+			{
+				_pdi.WriteByte(Pdi::CMD_REPEAT | Pdi::DATSIZE_4BYTES);
+				_pdi.Write(value);
+			}
 		}
+
+		StaticProgInterface<PdiPhy> _pdi;
+		uint8_t _erased;
+		uint32_t _writtenEnd[SectionsCount];
 	};
 }//namespace XMega
@@ -0,0 +1,151 @@
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "XmegaSimulator.h"
+
+// Host link of the simulated programmer: HwInterface for MkIIProtocol.
+// Runs on the simulator clock: a byte takes 10 bit times of the link baud rate
+// in each direction, TX has the 16 byte queue of the firmware Usart.
+// RX has the 32 byte queue of the firmware Usart: a byte that arrives while it is full
+// clears it as Usart::RxHandler does, such events are counted in Overflows().
+// Waiting for data advances the clock by SpinTime, so overlap of host transfer
+// and PDI work shows up in the simulated time.
+class SimLink
+{
+	struct Timed
+	{
+		uint64_t time;
+		uint8_t value;
+	};
+
+	struct LinkState
+	{
+		XMega::XmegaSimulator *clock;
+		uint32_t byteTime;
+		uint64_t rxLast;
+		uint64_t txFree;
+		uint32_t idleSpins;
+		uint32_t overflows;
+		std::deque<Timed> rx;
+		std::deque<uint8_t> rxQueue;
+		std::vector<uint8_t> tx;
+	};
+
+	static LinkState &State()
+	{
+		static LinkState state;
+		return state;
+	}
+public:
+	enum {TxQueueSize = 16, RxQueueSize = 32, SpinTime = 4, MaxIdleSpins = 100000};
+
+	// Firmware waits for host data that never comes
+	struct Underrun{};
+
+	static void Attach(XMega::XmegaSimulator *clock, uint32_t baud)
+	{
+		LinkState &s = State();
+		s.clock = clock;
+		s.byteTime = uint32_t(uint64_t(clock->Config().PdiClock) * 10 / baud);
+		s.rxLast = s.txFree = clock->Time();
+		s.idleSpins = 0;
+		s.overflows = 0;
+		s.rx.clear();
+		s.rxQueue.clear();
+		s.tx.clear();
+	}
+
+	// Programmer side
+	static uint8_t Putch(uint8_t c)
+	{
+		LinkState &s = State();
+		uint64_t now = s.clock->Time();
+		if(s.txFree > now + uint64_t(s.byteTime) * TxQueueSize)
+		{
+			s.clock->Wait(SpinTime);
+			return 0;
+		}
+		s.txFree = (s.txFree > now ? s.txFree : now) + s.byteTime;
+		s.tx.push_back(c);
+		return 1;
+	}
+
+	static uint8_t Getch(uint8_t &c)
+	{
+		LinkState &s = State();
+		Deliver(s);
+		if(!s.rxQueue.empty())
+		{
+			c = s.rxQueue.front();
+			s.rxQueue.pop_front();
+			s.idleSpins = 0;
+			return 1;
+		}
+		if(s.rx.empty() && ++s.idleSpins > MaxIdleSpins)
+		{
+			s.idleSpins = 0;
+			throw Underrun();
+		}
+		s.clock->Wait(SpinTime);
+		return 0;
+	}
+
+	static void BeginTxFrame(){}
+	static void EndTxFrame(){}
+	static void Disable(){}
+	static void Init(unsigned long){}
+
+	// Host side
+	static void Send(const std::vector<uint8_t> &data)
+	{
+		LinkState &s = State();
+		uint64_t now = s.clock->Time();
+		for(size_t i = 0; i < data.size(); i++)
+		{
+			s.rxLast = (s.rxLast > now ? s.rxLast : now) + s.byteTime;
+			Timed t = {s.rxLast, data[i]};
+			s.rx.push_back(t);
+		}
+	}
+
+	static bool RxPending()
+	{
+		return !State().rx.empty() || !State().rxQueue.empty();
+	}
+
+	// Number of times the firmware RX queue was cleared on overflow
+	static uint32_t Overflows()
+	{
+		return State().overflows;
+	}
+
+	// Waits for the last programmer byte to reach the host and takes all received bytes
+	static std::vector<uint8_t> Receive()
+	{
+		LinkState &s = State();
+		if(s.txFree > s.clock->Time())
+			s.clock->Wait(s.txFree - s.clock->Time());
+		std::vector<uint8_t> data;
+		data.swap(s.tx);
+		return data;
+	}
+
+private:
+	// Moves bytes that have arrived by now to the firmware RX queue
+	static void Deliver(LinkState &s)
+	{
+		uint64_t now = s.clock->Time();
+		while(!s.rx.empty() && s.rx.front().time <= now)
+		{
+			if(s.rxQueue.size() == RxQueueSize)
+			{
+				s.rxQueue.clear();
+				s.overflows++;
+			}
+			else
+				s.rxQueue.push_back(s.rx.front().value);
+			s.rx.pop_front();
+		}
+	}
+};
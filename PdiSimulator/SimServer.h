@@ -0,0 +1,104 @@
+#pragma once
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+#include "SimLink.h"
+
+// Serves the simulated programmer to a host client (MkIIHost) over a stream
+// file descriptor: TCP connection or pty master.
+// Whole MkII frames are collected before they are passed to the protocol,
+// so the firmware code never waits for host data that is still in the pipe.
+// Replies go out as fast as the host runs, they are not paced to the simulated clock.
+template<class Protocol>
+class SimServer
+{
+public:
+	SimServer(Protocol &protocol)
+		:_protocol(protocol), _frames(0)
+	{}
+
+	// Returns when the peer closes the connection
+	void Serve(int fd)
+	{
+		std::vector<uint8_t> pending;
+		uint8_t buffer[4096];
+		for(;;)
+		{
+			ssize_t n = read(fd, buffer, sizeof(buffer));
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return;
+			pending.insert(pending.end(), buffer, buffer + n);
+
+			size_t size;
+			while((size = FrameSize(pending)) != 0)
+			{
+				SimLink::Send(std::vector<uint8_t>(pending.begin(), pending.begin() + size));
+				pending.erase(pending.begin(), pending.begin() + size);
+				try
+				{
+					while(SimLink::RxPending())
+						_protocol.PollInterface();
+				}
+				catch(SimLink::Underrun)
+				{
+					fprintf(stderr, "frame %u: programmer waits for more data\n", _frames);
+				}
+				_frames++;
+				std::vector<uint8_t> reply = SimLink::Receive();
+				if(!WriteAll(fd, reply))
+					return;
+			}
+		}
+	}
+
+	unsigned Frames()const
+	{
+		return _frames;
+	}
+
+private:
+	// Size of the complete frame at the start of data, 0 if more data is needed.
+	// Bytes before a frame start are dropped as the firmware does.
+	static size_t FrameSize(std::vector<uint8_t> &data)
+	{
+		enum {HeaderSize = 8, CrcSize = 2, MaxBody = 0x10000};
+		for(;;)
+		{
+			size_t start = 0;
+			while(start < data.size() && data[start] != MessageStart)
+				start++;
+			data.erase(data.begin(), data.begin() + start);
+			if(data.size() < HeaderSize)
+				return 0;
+			uint32_t body = data[3] | (data[4] << 8) | (uint32_t(data[5]) << 16) | (uint32_t(data[6]) << 24);
+			if(data[7] != Token || body > MaxBody)
+			{
+				data.erase(data.begin());
+				continue;
+			}
+			size_t size = HeaderSize + body + CrcSize;
+			return data.size() >= size ? size : 0;
+		}
+	}
+
+	static bool WriteAll(int fd, const std::vector<uint8_t> &data)
+	{
+		size_t done = 0;
+		while(done < data.size())
+		{
+			ssize_t n = write(fd, &data[done], data.size() - done);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			done += n;
+		}
+		return true;
+	}
+
+	Protocol &_protocol;
+	unsigned _frames;
+};
@@ -0,0 +1,815 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "ProgInterface.h"
+#include "PdiCommands.h"
+#include "xMega.h"
+#include "NvmCrc.h"
+
+// Host model of an XMega target as seen through PDI.
+// Implements PDI instructions (LDS, STS, LD, ST, LDCS, STCS, REPEAT, KEY),
+// NVM controller registers at PDI_NVM_Offset and flash/EEPROM/fuse memories.
+// Time is counted in PDI clocks: 12 per frame plus guard time on each turn to target transmit.
+// NVM operations keep the controller busy for configured time.
+// Protocol violations are counted in ProtocolErrors, NVM misuse in NvmErrors.
+namespace XMega
+{
+	struct XmegaSimConfig
+	{
+		uint32_t AppSize;
+		uint32_t BootSize;
+		uint16_t FlashPageSize;
+		uint16_t EepromSize;
+		uint8_t EepromPageSize;
+		uint32_t PdiClock;			// Hz, for busy time conversion
+		uint32_t PageEraseTime;		// us
+		uint32_t PageWriteTime;		// us
+		uint32_t EepromWriteTime;	// us, erase and write
+		uint32_t ChipEraseTime;		// us
+		uint32_t CrcTimePerKb;		// us
+
+		// ATxmega32A4 like device at 1 MHz PDI clock
+		XmegaSimConfig()
+			:AppSize(32768),
+			BootSize(4096),
+			FlashPageSize(256),
+			EepromSize(1024),
+			EepromPageSize(32),
+			PdiClock(1000000),
+			PageEraseTime(2000),
+			PageWriteTime(2500),
+			EepromWriteTime(6000),
+			ChipEraseTime(40000),
+			CrcTimePerKb(100)
+		{}
+	};
+
+	struct XmegaSimStats
+	{
+		uint32_t BytesToTarget;
+		uint32_t BytesFromTarget;
+		uint32_t Instructions;
+		uint32_t BusyPolls;
+		uint32_t FlashPagesErased;
+		uint32_t FlashPagesWritten;
+		uint32_t EepromPagesWritten;
+		uint32_t ChipErases;
+		uint32_t ProtocolErrors;
+		uint32_t NvmErrors;
+	};
+
+	class XmegaSimulator
+	{
+	public:
+		enum
+		{
+			FlashBase = 0x0800000,
+			CalibrationBase = 0x08E0200,
+			UserSignatureBase = 0x08E0400,
+			FuseBase = 0x08F0020,
+			LockBitsAddress = 0x08F0027,
+			EepromBase = 0x08C0000,
+			DataBase = 0x1000000,
+			NvmBase = 0x10001C0,
+			DeviceIdBase = 0x1000090,
+			FusesCount = 7,
+			UserSignatureSize = 256,
+			NvmBusy = 1 << 7,
+			NvmFlashLoaded = 1 << 0,
+			NvmEepromLoaded = 1 << 1
+		};
+
+		XmegaSimulator(const XmegaSimConfig &config = XmegaSimConfig())
+			:_config(config),
+			_flash(config.AppSize + config.BootSize, 0xff),
+			_eeprom(config.EepromSize, 0xff),
+			_userSignature(UserSignatureSize, 0xff),
+			_flashBuffer(config.FlashPageSize, 0xff),
+			_eepromBuffer(config.EepromPageSize, 0xff),
+			_eepromLoaded(config.EepromPageSize, false)
+		{
+			memset(_fuses, 0xff, sizeof(_fuses));
+			memset(_deviceId, 0, sizeof(_deviceId));
+			_deviceId[0] = 0x1e;
+			_deviceId[1] = 0x95;
+			_deviceId[2] = 0x41;
+			ClearStats();
+			PowerOn();
+		}
+
+		void PowerOn()
+		{
+			_enabled = false;
+			_nvmEnabled = false;
+			_inReset = false;
+			_ctrl = 0;
+			_state = StateInstruction;
+			_pointer = 0;
+			_repeat = 0;
+			_readsLeft = 0;
+			_sending = true;
+			_time = 0;
+			_busyUntil = 0;
+			_linkLossIn = 0;
+			memset(_nvmRegs, 0, sizeof(_nvmRegs));
+			ResetBuffers();
+		}
+
+		void ClearStats()
+		{
+			memset(&_stats, 0, sizeof(_stats));
+		}
+
+		// ProgInterface side
+		void Enable()
+		{
+			_enabled = true;
+			_state = StateInstruction;
+			_readsLeft = 0;
+			_sending = true;
+		}
+
+		void Disable()
+		{
+			_enabled = false;
+			_nvmEnabled = false;
+		}
+
+		void Break()
+		{
+			_time += 12;
+		}
+
+		void Reset()
+		{
+			_nvmEnabled = false;
+		}
+
+		void WriteByte(uint8_t c)
+		{
+			_time += 12;
+			_stats.BytesToTarget++;
+			_sending = true;
+			if(!_enabled)
+			{
+				_stats.ProtocolErrors++;
+				return;
+			}
+			if(_readsLeft)
+			{
+				// target is still transmitting, frames collide
+				_stats.ProtocolErrors++;
+				_readsLeft = 0;
+				_state = StateInstruction;
+			}
+			Receive(c);
+		}
+
+		uint8_t ReadByte()
+		{
+			if(_sending)
+			{
+				_time += GuardTime();
+				_sending = false;
+			}
+			_time += 12;
+			_stats.BytesFromTarget++;
+			if(_linkLossIn && !--_linkLossIn)
+				Disable();
+			if(!_enabled || !_readsLeft)
+			{
+				_stats.ProtocolErrors++;
+				return 0xff;
+			}
+			uint8_t value = NextReadByte();
+			_readsLeft--;
+			if(!_readsLeft)
+				_state = StateInstruction;
+			return value;
+		}
+
+		// Memory model access for tests
+		std::vector<uint8_t> &Flash(){return _flash;}
+		std::vector<uint8_t> &Eeprom(){return _eeprom;}
+		uint8_t *Fuses(){return _fuses;}
+		const XmegaSimConfig &Config()const{return _config;}
+		const XmegaSimStats &Stats()const{return _stats;}
+		bool NvmEnabled()const{return _nvmEnabled;}
+		bool InReset()const{return _inReset;}
+		// PDI clocks since power on
+		uint64_t Time()const{return _time;}
+		// Programmer side delay
+		void Wait(uint64_t clocks){_time += clocks;}
+		// Target stops answering at the count-th byte read from it from now on, 0 cancels
+		void LoseLinkAfter(uint32_t count){_linkLossIn = count;}
+		double Seconds()const{return double(_time) / _config.PdiClock;}
+
+	protected:
+		enum State
+		{
+			StateInstruction,
+			StateAddress,		// LDS/STS address
+			StateStoreData,		// STS/ST data
+			StatePointer,		// ST ptr
+			StateRepeat,
+			StateStcs,
+			StateKey,
+			StateReading
+		};
+
+		uint32_t GuardTime()const
+		{
+			static const uint8_t guard[8] = {128, 64, 32, 16, 8, 4, 2, 2};
+			return guard[_ctrl & 7];
+		}
+
+		bool Busy()const
+		{
+			return _time < _busyUntil;
+		}
+
+		void SetBusy(uint32_t us)
+		{
+			_busyUntil = _time + uint64_t(us) * _config.PdiClock / 1000000;
+		}
+
+		void Receive(uint8_t c)
+		{
+			switch(_state)
+			{
+			case StateInstruction:
+				Instruction(c);
+				break;
+			case StateAddress:
+				_address |= uint32_t(c) << (_count * 8);
+				if(++_count == _addressSize)
+				{
+					_count = 0;
+					if(_instruction == Pdi::CMD_LDS)
+					{
+						_readAddress = _address;
+						_readPointer = &_readAddress;
+						StartRead(1);
+					}
+					else
+					{
+						_writeAddress = _address;
+						_writeIncrement = false;
+						_data = 0;
+						_itemsLeft = 1;
+						_state = StateStoreData;
+					}
+				}
+				break;
+			case StateStoreData:
+				_data |= uint32_t(c) << (_count * 8);
+				if(++_count == _dataSize)
+				{
+					for(uint8_t i = 0; i < _dataSize; i++)
+						WriteMemory(_writeAddress + i, uint8_t(_data >> (i * 8)));
+					if(_writeIncrement)
+						_pointer += _dataSize;
+					_writeAddress = _writeIncrement ? _pointer : _writeAddress;
+					_count = 0;
+					_data = 0;
+					if(--_itemsLeft == 0)
+						_state = StateInstruction;
+				}
+				break;
+			case StatePointer:
+				_data |= uint32_t(c) << (_count * 8);
+				if(++_count == _dataSize)
+				{
+					_pointer = _data;
+					_state = StateInstruction;
+				}
+				break;
+			case StateRepeat:
+				_data |= uint32_t(c) << (_count * 8);
+				if(++_count == _dataSize)
+				{
+					_repeat = _data;
+					_state = StateInstruction;
+				}
+				break;
+			case StateStcs:
+				StoreControl(_instruction & 0x0f, c);
+				_state = StateInstruction;
+				break;
+			case StateKey:
+				_key[_count++] = c;
+				if(_count == 8)
+				{
+					static const uint8_t nvmKey[8] = {0xff, 0x88, 0xd8, 0xcd, 0x45, 0xab, 0x89, 0x12};
+					if(memcmp(_key, nvmKey, 8) == 0)
+						_nvmEnabled = true;
+					else
+						_stats.ProtocolErrors++;
+					_state = StateInstruction;
+				}
+				break;
+			default:
+				_stats.ProtocolErrors++;
+				_state = StateInstruction;
+			}
+		}
+
+		void Instruction(uint8_t c)
+		{
+			_stats.Instructions++;
+			_instruction = c & 0xe0;
+			_dataSize = (c & 3) + 1;
+			_count = 0;
+			_data = 0;
+			uint32_t repeat = _repeat;
+			_repeat = 0;
+
+			switch(_instruction)
+			{
+			case Pdi::CMD_LDS:
+			case Pdi::CMD_STS:
+				_addressSize = ((c >> 2) & 3) + 1;
+				_address = 0;
+				_state = StateAddress;
+				break;
+			case Pdi::CMD_LD:
+				switch((c >> 2) & 3)
+				{
+				case Pdi::POINTER_INDIRECT:
+					_readAddress = _pointer;
+					_readPointer = &_readAddress;
+					StartRead(repeat + 1);
+					break;
+				case Pdi::POINTER_INDIRECT_PI:
+					_readPointer = &_pointer;
+					StartRead(repeat + 1);
+					break;
+				case Pdi::POINTER_DIRECT:
+					_readAddress = 0;
+					_readPointer = 0;
+					StartRead(1);
+					break;
+				default:
+					_stats.ProtocolErrors++;
+				}
+				break;
+			case Pdi::CMD_ST:
+				switch((c >> 2) & 3)
+				{
+				case Pdi::POINTER_INDIRECT:
+				case Pdi::POINTER_INDIRECT_PI:
+					_writeAddress = _pointer;
+					_writeIncrement = ((c >> 2) & 3) == Pdi::POINTER_INDIRECT_PI;
+					_itemsLeft = repeat + 1;
+					_state = StateStoreData;
+					break;
+				case Pdi::POINTER_DIRECT:
+					_state = StatePointer;
+					break;
+				default:
+					_stats.ProtocolErrors++;
+				}
+				break;
+			case Pdi::CMD_LDCS:
+				_readValue = LoadControl(c & 0x0f);
+				_readPointer = 0;
+				_dataSize = 1;
+				StartRead(1);
+				break;
+			case Pdi::CMD_STCS:
+				_instruction = c;
+				_state = StateStcs;
+				break;
+			case Pdi::CMD_REPEAT:
+				_state = StateRepeat;
+				break;
+			case Pdi::CMD_KEY:
+				_state = StateKey;
+				break;
+			}
+		}
+
+		void StartRead(uint32_t items)
+		{
+			_readsLeft = items * _dataSize;
+			_count = 0;
+			_state = StateReading;
+		}
+
+		uint8_t NextReadByte()
+		{
+			uint8_t value;
+			if(_instruction == Pdi::CMD_LDCS)
+				value = _readValue;
+			else if(!_readPointer)	// LD ptr
+				value = uint8_t(_pointer >> (_count * 8));
+			else
+			{
+				value = ReadMemory(*_readPointer);
+				++*_readPointer;
+			}
+			if(++_count == _dataSize)
+				_count = 0;
+			return value;
+		}
+
+		uint8_t LoadControl(uint8_t reg)
+		{
+			switch(reg)
+			{
+			case Pdi::STATUS_REG:
+				return _nvmEnabled ? Pdi::STATUS_NVM : 0;
+			case Pdi::RESET_REG:
+				return _inReset ? Pdi::RESET_KEY : 0;
+			case Pdi::CTRL_REG:
+				return _ctrl;
+			}
+			_stats.ProtocolErrors++;
+			return 0;
+		}
+
+		void StoreControl(uint8_t reg, uint8_t value)
+		{
+			switch(reg)
+			{
+			case Pdi::STATUS_REG:
+				if(!(value & Pdi::STATUS_NVM))
+					_nvmEnabled = false;
+				break;
+			case Pdi::RESET_REG:
+				_inReset = value == Pdi::RESET_KEY;
+				break;
+			case Pdi::CTRL_REG:
+				_ctrl = value & 7;
+				break;
+			default:
+				_stats.ProtocolErrors++;
+			}
+		}
+
+		static bool InRange(uint32_t address, uint32_t base, uint32_t size)
+		{
+			return address >= base && address - base < size;
+		}
+
+		uint8_t ReadMemory(uint32_t address)
+		{
+			if(InRange(address, NvmBase, sizeof(_nvmRegs)))
+				return ReadNvmReg(address - NvmBase);
+			if(InRange(address, DeviceIdBase, sizeof(_deviceId)))
+				return _deviceId[address - DeviceIdBase];
+
+			if(!CanAccessNvm(CMD_READNVM))
+				return 0xff;
+			if(InRange(address, FlashBase, _flash.size()))
+				return _flash[address - FlashBase];
+			if(InRange(address, EepromBase, _eeprom.size()))
+				return _eeprom[address - EepromBase];
+			if(InRange(address, FuseBase, FusesCount + 1))
+				return _fuses[address - FuseBase];
+			if(InRange(address, UserSignatureBase, _userSignature.size()))
+				return _userSignature[address - UserSignatureBase];
+			if(InRange(address, CalibrationBase, UserSignatureSize))
+				return 0x55;
+			_stats.NvmErrors++;
+			return 0xff;
+		}
+
+		void WriteMemory(uint32_t address, uint8_t value)
+		{
+			if(InRange(address, NvmBase, sizeof(_nvmRegs)))
+			{
+				WriteNvmReg(address - NvmBase, value);
+				return;
+			}
+			if(!CanAccessNvm(_nvmRegs[REG_CMD]))
+				return;
+
+			uint8_t command = _nvmRegs[REG_CMD];
+			if(InRange(address, FlashBase, _flash.size()))
+				FlashCommand(command, address - FlashBase, value);
+			else if(InRange(address, EepromBase, _eeprom.size()))
+				EepromCommand(command, address - EepromBase, value);
+			else if(InRange(address, FuseBase, FusesCount + 1))
+				FuseCommand(command, address - FuseBase, value);
+			else if(InRange(address, UserSignatureBase, _userSignature.size()))
+				UserSignatureCommand(command, address - UserSignatureBase, value);
+			else
+				_stats.NvmErrors++;
+		}
+
+		bool CanAccessNvm(uint8_t command)
+		{
+			if(!_nvmEnabled || Busy() || _nvmRegs[REG_CMD] != command)
+			{
+				_stats.NvmErrors++;
+				return false;
+			}
+			return true;
+		}
+
+		uint8_t ReadNvmReg(uint8_t reg)
+		{
+			if(reg == REG_STATUS)
+			{
+				uint8_t status = 0;
+				if(Busy())
+				{
+					status |= NvmBusy;
+					_stats.BusyPolls++;
+				}
+				if(_flashLoaded)
+					status |= NvmFlashLoaded;
+				if(_eepromLoadedAny)
+					status |= NvmEepromLoaded;
+				return status;
+			}
+			return _nvmRegs[reg];
+		}
+
+		void WriteNvmReg(uint8_t reg, uint8_t value)
+		{
+			if(!_nvmEnabled)
+			{
+				_stats.NvmErrors++;
+				return;
+			}
+			if(Busy() && reg != REG_STATUS)
+			{
+				// registers are locked while the controller is busy
+				_stats.NvmErrors++;
+				return;
+			}
+			_nvmRegs[reg] = value;
+			if(reg == REG_CTRLA && (value & 1))
+				ActionCommand(_nvmRegs[REG_CMD]);
+		}
+
+		void ActionCommand(uint8_t command)
+		{
+			_nvmRegs[REG_CTRLA] = 0;
+			switch(command)
+			{
+			case CMD_CHIPERASE:
+				memset(&_flash[0], 0xff, _flash.size());
+				memset(&_eeprom[0], 0xff, _eeprom.size());
+				_fuses[FusesCount] = 0xff;
+				_stats.ChipErases++;
+				SetBusy(_config.ChipEraseTime);
+				break;
+			case CMD_ERASEEEPROM:
+				memset(&_eeprom[0], 0xff, _eeprom.size());
+				SetBusy(_config.EepromWriteTime);
+				break;
+			case CMD_ERASEFLASHPAGEBUFF:
+				ResetFlashBuffer();
+				break;
+			case CMD_ERASEEEPROMPAGEBUFF:
+				ResetEepromBuffer();
+				break;
+			case CMD_APPCRC:
+				SectionCrc(0, _config.AppSize);
+				break;
+			case CMD_BOOTCRC:
+				SectionCrc(_config.AppSize, _config.BootSize);
+				break;
+			case CMD_FLASHCRC:
+				SectionCrc(0, _flash.size());
+				break;
+			default:
+				_stats.NvmErrors++;
+			}
+		}
+
+		void SectionCrc(uint32_t start, uint32_t size)
+		{
+			uint32_t crc = NvmCrc(&_flash[start], size);
+			_nvmRegs[REG_DAT0] = uint8_t(crc);
+			_nvmRegs[REG_DAT1] = uint8_t(crc >> 8);
+			_nvmRegs[REG_DAT2] = uint8_t(crc >> 16);
+			SetBusy(_config.CrcTimePerKb * (size / 1024));
+		}
+
+		void FlashCommand(uint8_t command, uint32_t offset, uint8_t value)
+		{
+			uint32_t page = offset - offset % _config.FlashPageSize;
+			bool boot = offset >= _config.AppSize;
+			switch(command)
+			{
+			case CMD_LOADFLASHPAGEBUFF:
+				_flashBuffer[offset % _config.FlashPageSize] = value;
+				_flashLoaded = true;
+				return;
+			case CMD_ERASEFLASHPAGE:
+				ErasePage(page);
+				SetBusy(_config.PageEraseTime);
+				return;
+			case CMD_ERASEAPPSECPAGE:
+			case CMD_ERASEBOOTSECPAGE:
+				if(boot != (command == CMD_ERASEBOOTSECPAGE))
+					break;
+				ErasePage(page);
+				SetBusy(_config.PageEraseTime);
+				return;
+			case CMD_WRITEAPPSECPAGE:
+			case CMD_WRITEBOOTSECPAGE:
+				if(boot != (command == CMD_WRITEBOOTSECPAGE))
+					break;
+				WritePage(page);
+				SetBusy(_config.PageWriteTime);
+				return;
+			case CMD_ERASEWRITEAPPSECPAGE:
+			case CMD_ERASEWRITEBOOTSECPAGE:
+				if(boot != (command == CMD_ERASEWRITEBOOTSECPAGE))
+					break;
+				ErasePage(page);
+				WritePage(page);
+				SetBusy(_config.PageEraseTime + _config.PageWriteTime);
+				return;
+			case CMD_ERASEAPPSEC:
+			case CMD_ERASEBOOTSEC:
+				{
+					bool bootSection = command == CMD_ERASEBOOTSEC;
+					if(boot != bootSection)
+						break;
+					uint32_t start = bootSection ? _config.AppSize : 0;
+					uint32_t size = bootSection ? _config.BootSize : _config.AppSize;
+					memset(&_flash[start], 0xff, size);
+					SetBusy(_config.ChipEraseTime);
+				}
+				return;
+			}
+			_stats.NvmErrors++;
+		}
+
+		void ErasePage(uint32_t page)
+		{
+			memset(&_flash[page], 0xff, _config.FlashPageSize);
+			_stats.FlashPagesErased++;
+		}
+
+		void WritePage(uint32_t page)
+		{
+			// programming only clears bits
+			for(uint16_t i = 0; i < _config.FlashPageSize; i++)
+				_flash[page + i] &= _flashBuffer[i];
+			ResetFlashBuffer();
+			_stats.FlashPagesWritten++;
+		}
+
+		void EepromCommand(uint8_t command, uint32_t offset, uint8_t value)
+		{
+			uint32_t page = offset - offset % _config.EepromPageSize;
+			switch(command)
+			{
+			case CMD_LOADEEPROMPAGEBUFF:
+				_eepromBuffer[offset % _config.EepromPageSize] = value;
+				_eepromLoaded[offset % _config.EepromPageSize] = true;
+				_eepromLoadedAny = true;
+				return;
+			case CMD_ERASEWRITEEEPROMPAGE:
+			case CMD_WRITEEEPROMPAGE:
+			case CMD_ERASEEEPROMPAGE:
+				// only loaded bytes are affected
+				for(uint8_t i = 0; i < _config.EepromPageSize; i++)
+				{
+					if(!_eepromLoaded[i])
+						continue;
+					if(command != CMD_WRITEEEPROMPAGE)
+						_eeprom[page + i] = 0xff;
+					if(command != CMD_ERASEEEPROMPAGE)
+						_eeprom[page + i] &= _eepromBuffer[i];
+				}
+				ResetEepromBuffer();
+				_stats.EepromPagesWritten++;
+				SetBusy(_config.EepromWriteTime);
+				return;
+			}
+			_stats.NvmErrors++;
+		}
+
+		void FuseCommand(uint8_t command, uint32_t offset, uint8_t value)
+		{
+			if(command == CMD_WRITEFUSE && offset < FusesCount)
+				_fuses[offset] = value;
+			else if(command == CMD_WRITELOCK && offset == FusesCount)
+				_fuses[offset] &= value;
+			else
+			{
+				_stats.NvmErrors++;
+				return;
+			}
+			SetBusy(_config.EepromWriteTime);
+		}
+
+		void UserSignatureCommand(uint8_t command, uint32_t offset, uint8_t value)
+		{
+			switch(command)
+			{
+			case CMD_LOADFLASHPAGEBUFF:
+				_flashBuffer[offset % _config.FlashPageSize] = value;
+				_flashLoaded = true;
+				return;
+			case CMD_ERASEUSERSIG:
+				memset(&_userSignature[0], 0xff, _userSignature.size());
+				SetBusy(_config.PageEraseTime);
+				return;
+			case CMD_WRITEUSERSIG:
+				for(uint16_t i = 0; i < _userSignature.size() && i < _config.FlashPageSize; i++)
+					_userSignature[i] &= _flashBuffer[i];
+				ResetFlashBuffer();
+				SetBusy(_config.PageWriteTime);
+				return;
+			}
+			_stats.NvmErrors++;
+		}
+
+		void ResetFlashBuffer()
+		{
+			std::fill(_flashBuffer.begin(), _flashBuffer.end(), 0xff);
+			_flashLoaded = false;
+		}
+
+		void ResetEepromBuffer()
+		{
+			std::fill(_eepromBuffer.begin(), _eepromBuffer.end(), 0xff);
+			std::fill(_eepromLoaded.begin(), _eepromLoaded.end(), false);
+			_eepromLoadedAny = false;
+		}
+
+		void ResetBuffers()
+		{
+			ResetFlashBuffer();
+			ResetEepromBuffer();
+		}
+
+		XmegaSimConfig _config;
+		XmegaSimStats _stats;
+
+		std::vector<uint8_t> _flash;
+		std::vector<uint8_t> _eeprom;
+		std::vector<uint8_t> _userSignature;
+		std::vector<uint8_t> _flashBuffer;
+		std::vector<uint8_t> _eepromBuffer;
+		std::vector<bool> _eepromLoaded;
+		bool _flashLoaded;
+		bool _eepromLoadedAny;
+		uint8_t _fuses[FusesCount + 1];
+		uint8_t _deviceId[3];
+		uint8_t _nvmRegs[0x40];
+
+		// PDI state
+		bool _enabled;
+		bool _nvmEnabled;
+		bool _inReset;
+		bool _sending;
+		uint8_t _ctrl;
+		uint8_t _state;
+		uint8_t _instruction;
+		uint8_t _addressSize;
+		uint8_t _dataSize;
+		uint8_t _count;
+		uint8_t _key[8];
+		uint8_t _readValue;
+		uint32_t _address;
+		uint32_t _data;
+		uint32_t _pointer;
+		uint32_t _repeat;
+		uint32_t _itemsLeft;
+		uint32_t _readsLeft;
+		uint32_t _readAddress;
+		uint32_t *_readPointer;
+		uint32_t _writeAddress;
+		bool _writeIncrement;
+
+		uint64_t _time;
+		uint64_t _busyUntil;
+		uint32_t _linkLossIn;
+	};
+
+	// ProgInterface for MkIIProtocol and Xmega, talks to the simulator set with Attach()
+	class PdiSimPhisical :public ProgInterface
+	{
+	public:
+		static void Attach(XmegaSimulator *target)
+		{
+			Target() = target;
+		}
+
+		void Enable(){Target()->Enable();}
+		void Disable(){Target()->Disable();}
+		void WriteByte(uint8_t c){Target()->WriteByte(c);}
+		uint8_t ReadByte(){return Target()->ReadByte();}
+		void Reset(){Target()->Reset();}
+		void Break(){Target()->Break();}
+
+	protected:
+		static XmegaSimulator *&Target()
+		{
+			static XmegaSimulator *target = 0;
+			return target;
+		}
+	};
+}
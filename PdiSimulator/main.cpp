@@ -0,0 +1,542 @@
+// End to end check and benchmark of the PDI programmer firmware on the host:
+// MkII frames -> SimLink -> MkIIProtocol -> Xmega -> PdiSimPhisical -> XmegaSimulator.
+// Times are simulated: PDI clock and host link baud rate of the configuration,
+// commands per second of the host CPU are printed for the firmware code path cost.
+//
+// With -t <port> or -p the simulated programmer is served to MkIIHost
+// over a local TCP port or a pty instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "MkiiProtocol.h"
+#include "SimLink.h"
+#include "XmegaSimulator.h"
+#include "SimServer.h"
+
+using namespace XMega;
+
+typedef MkII::MkIIProtocol<SimLink, PdiSimPhisical> Protocol;
+typedef std::vector<uint8_t> Bytes;
+
+static unsigned errors = 0;
+
+static void Put16(Bytes &b, uint16_t v)
+{
+	b.push_back(v & 0xff);
+	b.push_back(v >> 8);
+}
+
+static void Put32(Bytes &b, uint32_t v)
+{
+	Put16(b, v & 0xffff);
+	Put16(b, v >> 16);
+}
+
+static uint16_t FrameCrc(const Bytes &b, size_t size)
+{
+	uint16_t crc = 0xffff;
+	for(size_t i = 0; i < size; i++)
+		crc = Crc16Table::Update(b[i], crc);
+	return crc;
+}
+
+// Host side of MkII protocol talking to the simulated programmer
+class MkIIClient
+{
+public:
+	MkIIClient(Protocol &protocol)
+		:_protocol(protocol), _seq(0), _commands(0)
+	{}
+
+	// Returns response body: response id and data
+	Bytes Command(const Bytes &body)
+	{
+		uint16_t seq = _seq;
+		return Parse(Exchange(body), seq);
+	}
+
+	// Returns the whole reply frame as it is sent by the programmer
+	Bytes Exchange(const Bytes &body)
+	{
+		Bytes frame;
+		frame.push_back(MessageStart);
+		Put16(frame, _seq);
+		Put32(frame, body.size());
+		frame.push_back(Token);
+		frame.insert(frame.end(), body.begin(), body.end());
+		Put16(frame, FrameCrc(frame, frame.size()));
+
+		SimLink::Send(frame);
+		try
+		{
+			while(SimLink::RxPending())
+				_protocol.PollInterface();
+		}
+		catch(SimLink::Underrun)
+		{
+			printf("command %02x: programmer waits for more data\n", body[0]), errors++;
+		}
+		_commands++;
+		_seq++;
+		return SimLink::Receive();
+	}
+
+	uint8_t Simple(uint8_t command)
+	{
+		return Status(Command(Bytes(1, command)));
+	}
+
+	uint8_t SetParameter(uint8_t parameter, uint8_t value)
+	{
+		Bytes body;
+		body.push_back(CMND_SET_PARAMETER);
+		body.push_back(parameter);
+		body.push_back(value);
+		return Status(Command(body));
+	}
+
+	uint8_t Erase(uint8_t mode, uint32_t address)
+	{
+		Bytes body;
+		body.push_back(CMND_XMEGA_ERASE);
+		body.push_back(mode);
+		Put32(body, address);
+		return Status(Command(body));
+	}
+
+	uint8_t WriteMem(uint8_t memType, uint32_t address, const uint8_t *data, uint32_t size)
+	{
+		Bytes body;
+		body.push_back(CMND_WRITE_MEMORY);
+		body.push_back(memType);
+		Put32(body, size);
+		Put32(body, address);
+		body.insert(body.end(), data, data + size);
+		return Status(Command(body));
+	}
+
+	static Bytes ReadMemCommand(uint8_t memType, uint32_t address, uint32_t size)
+	{
+		Bytes body;
+		body.push_back(CMND_READ_MEMORY);
+		body.push_back(memType);
+		Put32(body, size);
+		Put32(body, address);
+		return body;
+	}
+
+	// Response id is removed
+	Bytes ReadMem(uint8_t memType, uint32_t address, uint32_t size)
+	{
+		Bytes response = Command(ReadMemCommand(memType, address, size));
+		if(Status(response) != RSP_MEMORY || response.size() != size + 1)
+		{
+			printf("read memory %06x: response %02x, %u bytes\n", address, Status(response), unsigned(response.size())), errors++;
+			return Bytes();
+		}
+		return Bytes(response.begin() + 1, response.end());
+	}
+
+	bool Crc(uint8_t section, uint32_t &crc)
+	{
+		Bytes body;
+		body.push_back(CMND_XMEGA_CRC);
+		body.push_back(section);
+		Bytes response = Command(body);
+		if(Status(response) != RSP_MEMORY || response.size() != 4)
+			return false;
+		crc = response[1] | (uint32_t(response[2]) << 8) | (uint32_t(response[3]) << 16);
+		return true;
+	}
+
+	unsigned Commands()const
+	{
+		return _commands;
+	}
+
+	static uint8_t Status(const Bytes &response)
+	{
+		return response.empty() ? 0 : response[0];
+	}
+
+private:
+	Bytes Parse(const Bytes &reply, uint16_t seq)
+	{
+		if(reply.size() < 10 || reply[0] != MessageStart || reply[7] != Token)
+		{
+			printf("bad reply frame, %u bytes\n", unsigned(reply.size())), errors++;
+			return Bytes();
+		}
+		uint16_t replySeq = reply[1] | (reply[2] << 8);
+		uint32_t size = reply[3] | (reply[4] << 8) | (uint32_t(reply[5]) << 16) | (uint32_t(reply[6]) << 24);
+		if(replySeq != seq || size + 10 != reply.size())
+		{
+			printf("reply seq %u, size %u, %u bytes\n", replySeq, size, unsigned(reply.size())), errors++;
+			return Bytes();
+		}
+		uint16_t crc = reply[reply.size() - 2] | (reply[reply.size() - 1] << 8);
+		if(crc != FrameCrc(reply, reply.size() - 2))
+		{
+			printf("reply crc\n"), errors++;
+			return Bytes();
+		}
+		return Bytes(reply.begin() + 8, reply.end() - 2);
+	}
+
+	Protocol &_protocol;
+	uint16_t _seq;
+	unsigned _commands;
+};
+
+#define CHECK(cond, ...) do{ if(!(cond)){ printf(__VA_ARGS__); printf("\n"); errors++; } }while(0)
+
+static Bytes MakeImage(uint32_t size, uint32_t pageSize, bool sparse)
+{
+	Bytes image(size, 0xff);
+	for(uint32_t i = 0; i < size; i++)
+	{
+		uint32_t page = i / pageSize;
+		// sparse image: code at the start, a table in the middle, rest blank
+		if(!sparse || page < size / pageSize / 4 || page == size / pageSize * 3 / 4)
+			image[i] = uint8_t(rand());
+	}
+	return image;
+}
+
+static unsigned WritePages(MkIIClient &host, uint8_t memType, uint32_t base, const Bytes &image, uint32_t pageSize)
+{
+	unsigned failed = 0;
+	for(uint32_t offset = 0; offset < image.size(); offset += pageSize)
+		if(host.WriteMem(memType, base + offset, &image[offset], pageSize) != RSP_OK)
+			failed++;
+	// result of the last page comes with the next command
+	if(host.Simple(CMND_CLEAR_EVENTS) != RSP_OK)
+		failed++;
+	return failed;
+}
+
+static unsigned NonBlankPages(const Bytes &image, uint32_t pageSize)
+{
+	unsigned count = 0;
+	for(uint32_t offset = 0; offset < image.size(); offset += pageSize)
+		for(uint32_t i = 0; i < pageSize; i++)
+			if(image[offset + i] != 0xff)
+			{
+				count++;
+				break;
+			}
+	return count;
+}
+
+void CheckEndToEnd()
+{
+	XmegaSimulator target;
+	const XmegaSimConfig &config = target.Config();
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, 115200);
+	Protocol protocol;
+	MkIIClient host(protocol);
+
+	Bytes signOn = host.Command(Bytes(1, CMND_GET_SIGN_ON));
+	CHECK(MkIIClient::Status(signOn) == RSP_SIGN_ON && signOn.size() == 29, "sign on");
+	CHECK(host.SetParameter(EmulatorMODE, PDI_XMEGA) == RSP_OK, "set emulator mode");
+	CHECK(host.Simple(CMND_ENTER_PROGMODE) == RSP_OK, "enter progmode");
+	CHECK(target.NvmEnabled(), "NVM is not enabled by the key");
+
+	// unknown command with payload is skipped, framing stays in sync
+	Bytes unknown(4, 0x1b);
+	unknown[0] = 0x33;
+	CHECK(MkIIClient::Status(host.Command(unknown)) == RSP_ILLEGAL_COMMAND, "illegal command");
+
+	CHECK(host.Erase(XMEGA_ERASE_CHIP, 0) == RSP_OK, "chip erase");
+	CHECK(target.Stats().ChipErases == 1, "chip erase is not executed");
+
+	Bytes image = MakeImage(config.AppSize, config.FlashPageSize, true);
+	target.ClearStats();
+	CHECK(WritePages(host, XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, image, config.FlashPageSize) == 0, "flash write");
+	Bytes readBack = host.ReadMem(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, config.AppSize);
+	CHECK(readBack == image, "flash read back");
+	CHECK(Bytes(target.Flash().begin(), target.Flash().begin() + config.AppSize) == image, "flash content");
+	CHECK(target.Stats().FlashPagesWritten == NonBlankPages(image, config.FlashPageSize),
+		"%u pages written, %u not blank", target.Stats().FlashPagesWritten, NonBlankPages(image, config.FlashPageSize));
+
+	uint32_t crc = 0;
+	CHECK(host.Crc(XMEGA_CRC_APP, crc), "crc command");
+	CHECK(crc == NvmCrc(&image[0], image.size()), "app crc %06x, expected %06x", crc, NvmCrc(&image[0], image.size()));
+	CHECK(host.Crc(XMEGA_CRC_BOOT, crc) && crc == NvmCrcFill(0, 0xff, config.BootSize), "boot crc %06x", crc);
+
+	Bytes eeprom = MakeImage(config.EepromPageSize, config.EepromPageSize, false);
+	CHECK(host.WriteMem(EEPROM, XmegaSimulator::EepromBase + 64, &eeprom[0], eeprom.size()) == RSP_OK, "eeprom write");
+	CHECK(host.ReadMem(EEPROM, XmegaSimulator::EepromBase + 64, eeprom.size()) == eeprom, "eeprom read back");
+
+	uint8_t fuse = 0xfe;
+	CHECK(host.WriteMem(FUSE_BITS, XmegaSimulator::FuseBase + 2, &fuse, 1) == RSP_OK, "fuse write");
+	CHECK(target.Fuses()[2] == 0xfe, "fuse value %02x", target.Fuses()[2]);
+
+	// compare mode, one page changed
+	image[config.FlashPageSize + 5] ^= 0x5a;
+	CHECK(host.SetParameter(CompareBeforeWrite, 1) == RSP_OK, "compare mode");
+	target.ClearStats();
+	CHECK(WritePages(host, XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, image, config.FlashPageSize) == 0, "compare write");
+	CHECK(host.Simple(CMND_LEAVE_PROGMODE) == RSP_OK, "leave progmode");
+	CHECK(target.Stats().FlashPagesWritten == 1, "%u pages written in compare mode", target.Stats().FlashPagesWritten);
+	CHECK(Bytes(target.Flash().begin(), target.Flash().begin() + config.AppSize) == image, "flash content after compare write");
+	CHECK(!target.InReset(), "target is left in reset");
+
+	CHECK(target.Stats().ProtocolErrors == 0, "%u PDI protocol errors", target.Stats().ProtocolErrors);
+	CHECK(target.Stats().NvmErrors == 0, "%u NVM errors", target.Stats().NvmErrors);
+	CHECK(SimLink::Overflows() == 0, "%u host link RX overflows", SimLink::Overflows());
+}
+
+// Known answers of the NVM CRC, computed as the remainder of the message
+// polynomial times x^24 divided by x^24 + x^4 + x^3 + x + 1,
+// so the simulator and the host do not only agree with each other
+void CheckNvmCrc()
+{
+	const char check[] = "123456789";
+	uint32_t crc = NvmCrc((const uint8_t *)check, sizeof(check) - 1);
+	CHECK(crc == 0x3c1537, "crc of \"123456789\" %06x, expected 3c1537", crc);
+	crc = NvmCrcFill(0, 0xff, 512);
+	CHECK(crc == 0xa94a37, "crc of 512 blank bytes %06x, expected a94a37", crc);
+}
+
+// Target lost in the middle of a streamed read: the reply frame must fail the CRC check
+void CheckReadAbort()
+{
+	XmegaSimulator target;
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, 115200);
+	Protocol protocol;
+	MkIIClient host(protocol);
+
+	host.SetParameter(EmulatorMODE, PDI_XMEGA);
+	host.Simple(CMND_ENTER_PROGMODE);
+	const uint32_t size = 1024;
+	target.LoseLinkAfter(size / 2);
+	Bytes reply = host.Exchange(MkIIClient::ReadMemCommand(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, size));
+	CHECK(reply.size() == size + 11, "aborted read reply size %u", unsigned(reply.size()));
+	if(reply.size() > 2)
+	{
+		uint16_t crc = reply[reply.size() - 2] | (reply[reply.size() - 1] << 8);
+		CHECK(crc != FrameCrc(reply, reply.size() - 2), "read from a lost target is not aborted");
+	}
+}
+
+// Host stops in the middle of page data: the page is dropped and the programmer
+// answers without waiting for the rest of the frame
+void CheckWriteTimeout()
+{
+	XmegaSimulator target;
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, 115200);
+	Protocol protocol;
+	MkIIClient host(protocol);
+
+	host.SetParameter(EmulatorMODE, PDI_XMEGA);
+	host.Simple(CMND_ENTER_PROGMODE);
+	Bytes body;
+	body.push_back(CMND_WRITE_MEMORY);
+	body.push_back(XMEGA_APPLICATION_FLASH);
+	Put32(body, target.Config().FlashPageSize);
+	Put32(body, XmegaSimulator::FlashBase);
+	body.resize(body.size() + target.Config().FlashPageSize / 2, 0);
+	CHECK(MkIIClient::Status(host.Command(body)) == RSP_FAILED, "truncated page write");
+	CHECK(MkIIClient::Status(host.Command(Bytes(1, CMND_GET_SIGN_ON))) == RSP_SIGN_ON, "no sign on after truncated page write");
+	CHECK(target.Flash()[0] == 0xff, "truncated page is written");
+	CHECK(target.Stats().ProtocolErrors == 0 && target.Stats().NvmErrors == 0,
+		"truncated page write: %u protocol, %u NVM errors", target.Stats().ProtocolErrors, target.Stats().NvmErrors);
+}
+
+// Blank page after chip erase is acknowledged from the received data, no PDI traffic
+void CheckBlankPage()
+{
+	XmegaSimulator target;
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, 115200);
+	Protocol protocol;
+	MkIIClient host(protocol);
+
+	host.SetParameter(EmulatorMODE, PDI_XMEGA);
+	host.Simple(CMND_ENTER_PROGMODE);
+	CHECK(host.Erase(XMEGA_ERASE_CHIP, 0) == RSP_OK, "chip erase");
+	uint32_t pageSize = target.Config().FlashPageSize;
+	Bytes page(pageSize, 0xff);
+	target.ClearStats();
+	CHECK(host.WriteMem(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase + pageSize * 4, &page[0], pageSize) == RSP_OK, "blank page write");
+	CHECK(host.Simple(CMND_CLEAR_EVENTS) == RSP_OK, "blank page result");
+	uint32_t pdiBytes = target.Stats().BytesToTarget + target.Stats().BytesFromTarget;
+	CHECK(pdiBytes == 0, "%u PDI bytes for a blank page", pdiBytes);
+
+	page[0] = 0;
+	CHECK(host.WriteMem(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase + pageSize * 5, &page[0], pageSize) == RSP_OK, "page write");
+	CHECK(host.Simple(CMND_CLEAR_EVENTS) == RSP_OK, "page result");
+	CHECK(target.Stats().BytesToTarget > pageSize && target.Stats().FlashPagesWritten == 1,
+		"page write: %u PDI bytes, %u pages written", target.Stats().BytesToTarget, target.Stats().FlashPagesWritten);
+}
+
+// Target lost while a page is written: the failure is the reply to the next page,
+// the page after it fails on the command that follows
+void CheckPageFailure()
+{
+	XmegaSimulator target;
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, 115200);
+	Protocol protocol;
+	MkIIClient host(protocol);
+
+	host.SetParameter(EmulatorMODE, PDI_XMEGA);
+	host.Simple(CMND_ENTER_PROGMODE);
+	uint32_t pageSize = target.Config().FlashPageSize;
+	Bytes image = MakeImage(pageSize * 2, pageSize, false);
+	CHECK(host.WriteMem(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, &image[0], pageSize) == RSP_OK, "first page");
+	// the first reads are the controller checks before page load and write command
+	target.LoseLinkAfter(3);
+	CHECK(host.WriteMem(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase + pageSize, &image[pageSize], pageSize) == RSP_FAILED,
+		"failed page write is not reported on the next page");
+	CHECK(host.Simple(CMND_CLEAR_EVENTS) == RSP_FAILED, "failed last page is not reported on the next command");
+	CHECK(host.Simple(CMND_CLEAR_EVENTS) == RSP_OK, "page failure is reported twice");
+	CHECK(SimLink::Overflows() == 0, "%u host link RX overflows", SimLink::Overflows());
+}
+
+void Benchmark(uint32_t pdiClock, uint32_t baud)
+{
+	XmegaSimConfig config;
+	config.PdiClock = pdiClock;
+	XmegaSimulator target(config);
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, baud);
+	Protocol protocol;
+	MkIIClient host(protocol);
+
+	host.SetParameter(EmulatorMODE, PDI_XMEGA);
+	host.Simple(CMND_ENTER_PROGMODE);
+	Bytes image = MakeImage(config.AppSize, config.FlashPageSize, false);
+
+	double start = target.Seconds();
+	unsigned commands = host.Commands();
+	clock_t wall = clock();
+	if(host.Erase(XMEGA_ERASE_CHIP, 0) != RSP_OK)
+		printf("benchmark erase\n"), errors++;
+	if(WritePages(host, XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, image, config.FlashPageSize))
+		printf("benchmark write\n"), errors++;
+	double write = target.Seconds() - start;
+	commands = host.Commands() - commands;
+	double wallTime = double(clock() - wall) / CLOCKS_PER_SEC;
+
+	start = target.Seconds();
+	Bytes readBack = host.ReadMem(XMEGA_APPLICATION_FLASH, XmegaSimulator::FlashBase, config.AppSize);
+	double read = target.Seconds() - start;
+	host.Simple(CMND_LEAVE_PROGMODE);
+	if(readBack != image)
+		printf("benchmark read back\n"), errors++;
+
+	printf("PDI %4u kHz, link %7u baud: erase and write %6.2f KB/s (%5.1f commands/s), read %6.2f KB/s, host %.0f commands/s\n",
+		pdiClock / 1000, baud,
+		image.size() / 1024.0 / write, commands / write,
+		image.size() / 1024.0 / read,
+		wallTime > 0 ? commands / wallTime : 0.0);
+	if(target.Stats().ProtocolErrors || target.Stats().NvmErrors || SimLink::Overflows())
+		printf("benchmark: %u protocol, %u NVM errors, %u RX overflows\n",
+			target.Stats().ProtocolErrors, target.Stats().NvmErrors, SimLink::Overflows()), errors++;
+}
+
+// TCP server on the loopback interface, one client at a time
+int ServeTcp(SimServer<Protocol> &server, int port)
+{
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) || listen(listenFd, 1))
+	{
+		perror("listen");
+		return 1;
+	}
+	printf("simulated programmer on 127.0.0.1:%d\n", port);
+	fflush(stdout);
+	for(;;)
+	{
+		int fd = accept(listenFd, 0, 0);
+		if(fd < 0)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		server.Serve(fd);
+		close(fd);
+		printf("connection closed, %u frames, %u RX overflows\n", server.Frames(), SimLink::Overflows());
+		fflush(stdout);
+	}
+}
+
+// Pty in raw mode, the client opens the printed slave device.
+// Reading the master fails while no client has the slave open.
+int ServePty(SimServer<Protocol> &server)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if(fd < 0 || grantpt(fd) || unlockpt(fd))
+	{
+		perror("pty");
+		return 1;
+	}
+	termios tio;
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+	printf("simulated programmer on %s\n", ptsname(fd));
+	fflush(stdout);
+	for(;;)
+	{
+		server.Serve(fd);
+		usleep(100000);
+	}
+}
+
+int Serve(int argc, char *argv[])
+{
+	static XmegaSimulator target;
+	PdiSimPhisical::Attach(&target);
+	SimLink::Attach(&target, 115200);
+	static Protocol protocol;
+	SimServer<Protocol> server(protocol);
+	if(strcmp(argv[1], "-p") == 0)
+		return ServePty(server);
+	if(strcmp(argv[1], "-t") == 0 && argc > 2)
+		return ServeTcp(server, atoi(argv[2]));
+	printf("usage: PdiSimulator [-t port | -p]\n");
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1)
+		return Serve(argc, argv);
+
+	srand(1);
+	CheckNvmCrc();
+	CheckEndToEnd();
+	CheckReadAbort();
+	CheckWriteTimeout();
+	CheckBlankPage();
+	CheckPageFailure();
+	printf("check: %u errors\n", errors);
+
+	Benchmark(100000, 115200);
+	Benchmark(1000000, 115200);
+	Benchmark(1000000, 1000000);
+	Benchmark(4000000, 1000000);
+	return errors != 0;
+}
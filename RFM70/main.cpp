@@ -46,6 +46,7 @@ int main()
 	MyFormater formater;
 	formater.PutsP(PSTR("Rfm70 test programm\r\n"));
 
+	Spi2::Init();
 	Transiver2::Init();
 	
 	Transiver2::SwitchToRxMode();
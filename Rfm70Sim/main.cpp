@@ -0,0 +1,302 @@
+// Rfm70 drivers running on emulated transivers.
+// Measures link layer throughput vs loss rate and retransmit delay,
+// throughput next to a Wi-Fi like interferer with and without channel hopping,
+// and packet delivery of several nodes sending to one gateway.
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include "VirtualRfm70.h"
+#include "Rfm70Link.h"
+#include "Rfm70Hopping.h"
+
+using namespace VirtualRf;
+
+enum{StepTime = 10}; //us, main loop period
+
+template<uint8_t Retry, uint8_t Rate = DataRate2Mbps>
+struct SimDefaults :public Rfm70Defaults
+{
+	static const uint8_t RfSetup 	= Rate | OutputPower5dBm | LnaHighGain;
+	static const uint8_t RetrySetrup = Retry;
+};
+
+typedef VirtualRfm70<0> Radio0;
+typedef VirtualRfm70<1> Radio1;
+
+static uint8_t image[64*1024];
+
+template<class Transiver>
+void SetAddresses()
+{
+	Transiver::SetTxAddress(0x12345678, 0x90);
+	Transiver::template SetRxAddress<0>(0x12345678, 0x90);
+}
+
+void PrintResult(uint32_t bytes, double time)
+{
+	std::cout << std::setw(8) << bytes << " bytes in " << std::setw(9) << unsigned(time / 1000) << " ms, "
+		<< std::setw(6) << unsigned(bytes * 8 / time * 1000) << " kbps";
+}
+
+void PrintStats(const ChipStats &stats)
+{
+	std::cout << ", sent: " << stats.sent
+		<< ", retransmits: " << stats.retransmits
+		<< ", failed: " << stats.failed;
+}
+
+// Image transfer with Rfm70Link, returns number of bytes recived
+template<class Tx, class Rx>
+uint32_t TransferImage(uint32_t imageSize)
+{
+	typedef Rfm70Link<Tx, 1024, 2> TxLink;
+	typedef Rfm70Link<Rx, 1024, 2> RxLink;
+
+	Medium &medium = Medium::Instance();
+	TxLink::Init();
+	RxLink::Init();
+	SetAddresses<Tx>();
+	SetAddresses<Rx>();
+
+	uint32_t sent = 0, chunk = 0, received = 0;
+	bool pending = false;
+	while(received < imageSize && medium.Now() < 60e6)
+	{
+		if(!pending && sent < imageSize)
+		{
+			chunk = imageSize - sent < 1024 ? imageSize - sent : 1024;
+			pending = TxLink::Send(image + sent, chunk);
+		}
+		medium.Run(StepTime);
+		Tx::Poll();
+		Rx::Poll();
+		TxLink::Poll();
+		RxLink::Poll();
+		if(pending && !TxLink::IsSending())
+		{
+			if(TxLink::LastSendSucceeded())
+				sent += chunk;
+			pending = false;
+		}
+		Rfm70LinkMessage message;
+		while(RxLink::Receive(message))
+		{
+			received += message.length;
+			RxLink::Release(message);
+		}
+	}
+	return received;
+}
+
+template<uint8_t Retry>
+void LinkThroughput(double lossRate, uint32_t imageSize)
+{
+	typedef SimDefaults<Retry> Defaults;
+	typedef Rfm70Irq<Radio0::Spi, Radio0::SelectPin, Radio0::EnablePin, Radio0::IrqPin, Defaults, 4, 8> Tx;
+	typedef Rfm70Irq<Radio1::Spi, Radio1::SelectPin, Radio1::EnablePin, Radio1::IrqPin, Defaults, 8, 4> Rx;
+
+	Medium &medium = Medium::Instance();
+	medium.Reset();
+	medium.SetLossRate(lossRate);
+	uint32_t received = TransferImage<Tx, Rx>(imageSize);
+
+	std::cout << "link   loss " << std::setw(4) << lossRate * 100 << "%, ARD "
+		<< std::setw(4) << ((Retry >> 4) + 1) * 250 << "us: ";
+	PrintResult(received, medium.Now());
+	PrintStats(Radio0::Chip().Stats());
+	std::cout << ", dropped: " << unsigned(Rfm70Link<Rx, 1024, 2>::DroppedMessages()) << std::endl;
+}
+
+// Wi-Fi like interferer over 20 MHz around the default channel
+template<class Tx, class Rx>
+void WiFiThroughput(double busyProbability, uint32_t imageSize, const char *mode)
+{
+	Medium &medium = Medium::Instance();
+	medium.Reset();
+	for(int channel = Rfm70Defaults::RfChannel - 10; channel <= Rfm70Defaults::RfChannel + 10; channel++)
+		medium.SetChannelNoise(channel, busyProbability);
+	uint32_t received = TransferImage<Tx, Rx>(imageSize);
+
+	std::cout << "wi-fi  busy " << std::setw(4) << busyProbability * 100 << "%, " << mode;
+	PrintResult(received, medium.Now());
+	PrintStats(Radio0::Chip().Stats());
+	std::cout << ", channel: " << unsigned(Tx::RfChannel()) << std::endl;
+}
+
+// Stop and wait transfer of 32 bytes payloads with Rfm70Irq
+template<uint8_t Retry>
+void StopAndWaitThroughput(double lossRate, uint32_t imageSize)
+{
+	typedef SimDefaults<Retry> Defaults;
+	typedef Rfm70Irq<Radio0::Spi, Radio0::SelectPin, Radio0::EnablePin, Radio0::IrqPin, Defaults> Tx;
+	typedef Rfm70Irq<Radio1::Spi, Radio1::SelectPin, Radio1::EnablePin, Radio1::IrqPin, Defaults> Rx;
+
+	Medium &medium = Medium::Instance();
+	medium.Reset();
+	medium.SetLossRate(lossRate);
+
+	Tx::Init();
+	Rx::Init();
+	SetAddresses<Tx>();
+	SetAddresses<Rx>();
+
+	uint32_t sent = 0, received = 0;
+	while(received < imageSize && medium.Now() < 60e6)
+	{
+		if(Tx::State() == Rfm70Listening && sent < imageSize)
+		{
+			if(Tx::Send(image + sent, Rfm70MaxPayload))
+				sent += Rfm70MaxPayload;
+		}
+		medium.Run(StepTime);
+		Tx::Poll();
+		Rx::Poll();
+		Rfm70Packet packet;
+		while(Rx::Receive(packet))
+			received += packet.length;
+		while(Tx::Receive(packet));
+	}
+
+	std::cout << "stop&w loss " << std::setw(4) << lossRate * 100 << "%, ARD "
+		<< std::setw(4) << ((Retry >> 4) + 1) * 250 << "us: ";
+	PrintResult(received, medium.Now());
+	PrintStats(Radio0::Chip().Stats());
+	std::cout << std::endl;
+}
+
+// Several nodes send packets at random times to one gateway.
+// Nodes use the same retransmit delay, so collided packets tend to collide again on retransmits.
+template<int Id>
+struct Node
+{
+	typedef VirtualRfm70<Id> Radio;
+	typedef Rfm70Irq<typename Radio::Spi, typename Radio::SelectPin,
+		typename Radio::EnablePin, typename Radio::IrqPin, SimDefaults<Wait500us | 5> > Transiver;
+
+	static void Init()
+	{
+		Transiver::Init();
+		SetAddresses<Transiver>();
+	}
+
+	// Nodes share the gateway address on pipe 0 to receive ACKs,
+	// so they are kept powered down while idle, otherwise they would ACK each other.
+	static bool Send(const void *data, uint8_t size)
+	{
+		if(Transiver::State() == Rfm70PoweredDown)
+			Transiver::PowerUp();
+		return Transiver::Send(data, size);
+	}
+
+	static void Poll()
+	{
+		Transiver::Poll();
+		Rfm70Packet packet;
+		while(Transiver::Receive(packet));
+		if(Transiver::State() == Rfm70Listening)
+			Transiver::PowerDown();
+	}
+
+	static const ChipStats &Stats()
+	{
+		return Radio::Chip().Stats();
+	}
+};
+
+struct NodeFuncs
+{
+	void (*init)();
+	bool (*send)(const void *data, uint8_t size);
+	void (*poll)();
+	const ChipStats &(*stats)();
+};
+
+void ManyNodes(unsigned nodesCount, double packetsPerSecond)
+{
+	typedef Node<0> Gateway;
+	const NodeFuncs nodes[] =
+	{
+		{Node<2>::Init, Node<2>::Send, Node<2>::Poll, Node<2>::Stats},
+		{Node<3>::Init, Node<3>::Send, Node<3>::Poll, Node<3>::Stats},
+		{Node<4>::Init, Node<4>::Send, Node<4>::Poll, Node<4>::Stats},
+		{Node<5>::Init, Node<5>::Send, Node<5>::Poll, Node<5>::Stats},
+		{Node<6>::Init, Node<6>::Send, Node<6>::Poll, Node<6>::Stats},
+		{Node<7>::Init, Node<7>::Send, Node<7>::Poll, Node<7>::Stats},
+		{Node<8>::Init, Node<8>::Send, Node<8>::Poll, Node<8>::Stats},
+		{Node<9>::Init, Node<9>::Send, Node<9>::Poll, Node<9>::Stats}
+	};
+	const unsigned maxNodes = sizeof(nodes) / sizeof(nodes[0]);
+	if(nodesCount > maxNodes)
+		nodesCount = maxNodes;
+
+	Medium &medium = Medium::Instance();
+	medium.Reset();
+	Gateway::Init();
+	for(unsigned i = 0; i < nodesCount; i++)
+		nodes[i].init();
+
+	const double duration = 10e6;
+	const double sendProbability = packetsPerSecond * StepTime / 1e6;
+	uint32_t queued = 0, received = 0, collisionsBefore = medium.Stats().collisions;
+	srand(1);
+	while(medium.Now() < duration)
+	{
+		for(unsigned i = 0; i < nodesCount; i++)
+		{
+			// payloads must differ, otherwise the gateway takes packets
+			// from different nodes with the same PID for retransmits
+			if(rand() < sendProbability * RAND_MAX && nodes[i].send(image + (queued & 0x7fff), Rfm70MaxPayload))
+				queued++;
+			nodes[i].poll();
+		}
+		medium.Run(StepTime);
+		Gateway::Transiver::Poll();
+		Rfm70Packet packet;
+		while(Gateway::Transiver::Receive(packet))
+			received++;
+	}
+
+	uint32_t failed = 0, retransmits = 0;
+	for(unsigned i = 0; i < nodesCount; i++)
+	{
+		failed += nodes[i].stats().failed;
+		retransmits += nodes[i].stats().retransmits;
+	}
+	std::cout << "nodes " << nodesCount << ", " << packetsPerSecond << " pkt/s each: queued " << queued
+		<< ", received " << received
+		<< ", failed " << failed
+		<< ", retransmits " << retransmits
+		<< ", collisions " << medium.Stats().collisions - collisionsBefore << std::endl;
+}
+
+int main()
+{
+	for(unsigned i = 0; i < sizeof(image); i++)
+		image[i] = rand();
+
+	const uint32_t imageSize = 16*1024;
+	const double lossRates[] = {0, 0.01, 0.05, 0.2};
+	for(unsigned i = 0; i < sizeof(lossRates) / sizeof(lossRates[0]); i++)
+	{
+		StopAndWaitThroughput<Wait250us | 15>(lossRates[i], imageSize);
+		LinkThroughput<Wait250us | 15>(lossRates[i], imageSize);
+		LinkThroughput<Wait500us | 15>(lossRates[i], imageSize);
+		LinkThroughput<Wait1000us | 15>(lossRates[i], imageSize);
+	}
+
+	typedef Rfm70Irq<Radio0::Spi, Radio0::SelectPin, Radio0::EnablePin, Radio0::IrqPin, SimDefaults<Wait250us | 15>, 4, 8> WiFiTx;
+	typedef Rfm70Irq<Radio1::Spi, Radio1::SelectPin, Radio1::EnablePin, Radio1::IrqPin, SimDefaults<Wait250us | 15>, 8, 4> WiFiRx;
+	const double busy[] = {0.1, 0.3, 0.5};
+	for(unsigned i = 0; i < sizeof(busy) / sizeof(busy[0]); i++)
+	{
+		WiFiThroughput<WiFiTx, WiFiRx>(busy[i], imageSize, "fixed:   ");
+		WiFiThroughput<Rfm70Hopping<WiFiTx, Rfm70HopMaster>, Rfm70Hopping<WiFiRx, Rfm70HopSlave> >
+			(busy[i], imageSize, "hopping: ");
+	}
+
+	for(unsigned nodes = 1; nodes <= 8; nodes *= 2)
+		ManyNodes(nodes, 100);
+	return 0;
+}
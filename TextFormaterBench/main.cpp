@@ -0,0 +1,531 @@
+// Host benchmark and check of TextFormater number output.
+// Compares division free NumberFormat with snprintf and with a generic
+// division loop like ultoa(value, buffer, radix) does,
+// and fixed point output with snprintf of doubles.
+// Checks compile time formats against snprintf with the same layout
+// and buffered output against direct output.
+// Checks streaming number input with round trips of printed values.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <TextFormater.h>
+#include <format_string.h>
+#include <buffered_sink.h>
+
+class BufferSink
+{
+public:
+	static void Putch(uint8_t c)
+	{
+		*_pos++ = c;
+	}
+
+	static void Reset()
+	{
+		_pos = _buffer;
+	}
+
+	static const char *Str()
+	{
+		*_pos = 0;
+		return _buffer;
+	}
+
+private:
+	static char _buffer[64];
+	static char *_pos;
+};
+
+char BufferSink::_buffer[64];
+char *BufferSink::_pos = BufferSink::_buffer;
+
+// BufferSink with block write, counts calls
+class BlockSink :public BufferSink
+{
+public:
+	static void Write(const void *data, uint8_t size)
+	{
+		for(uint8_t i = 0; i < size; i++)
+			Putch(((const uint8_t *)data)[i]);
+		writes++;
+	}
+	static unsigned writes;
+};
+
+unsigned BlockSink::writes = 0;
+
+// Getch from a string
+class StringSource
+{
+public:
+	static void Getch(uint8_t &c)
+	{
+		c = *_pos ? *_pos++ : 0;
+	}
+
+	static void Set(const char *str)
+	{
+		_pos = str;
+	}
+
+private:
+	static const char *_pos;
+};
+
+const char *StringSource::_pos = "";
+
+class Console :public BufferSink, public StringSource
+{};
+
+typedef TextFormater<Console> In;
+typedef TextFormater<Console, 16> HexIn;
+static In in;
+static HexIn hexIn;
+
+typedef TextFormater<BufferSink> Out;
+typedef TextFormater<BufferSink, 16> HexOut;
+
+static Out out;
+static HexOut hexOut;
+
+typedef TextFormater<BufferedSink<BlockSink, 32> > BlockOut;
+typedef TextFormater<BufferedSink<BufferSink, 16, false> > PutchOut;
+static BlockOut blockOut;
+static PutchOut putchOut;
+
+// radix is a variable, as in ultoa(), so the compiler emits real division
+char *DivisionLoop(uint32_t value, char *buffer, volatile int radix)
+{
+	char tmp[32], *p = tmp;
+	int r = radix;
+	do
+	{
+		uint8_t digit = value % r;
+		value /= r;
+		*p++ = digit < 10 ? '0' + digit : 'a' - 10 + digit;
+	}while(value);
+	char *dst = buffer;
+	while(p != tmp)
+		*dst++ = *--p;
+	*dst = 0;
+	return buffer;
+}
+
+static unsigned errors = 0;
+
+void Check(const char *expected)
+{
+	const char *actual = BufferSink::Str();
+	if(strcmp(expected, actual) != 0)
+	{
+		if(errors < 10)
+			printf("mismatch: expected '%s', got '%s'\n", expected, actual);
+		errors++;
+	}
+}
+
+template<class T>
+void CheckValue(T value)
+{
+	char expected[64];
+	long long v = value;
+
+	BufferSink::Reset();
+	out << value;
+	sprintf(expected, "%lld", v);
+	Check(expected);
+
+	BufferSink::Reset();
+	out << Dec(value, 12, FormatZeroPad | FormatPlusSign);
+	sprintf(expected, "%+012lld", v);
+	Check(expected);
+
+	BufferSink::Reset();
+	out << Dec(value, 12, FormatLeftAlign);
+	sprintf(expected, "%-12lld", v);
+	Check(expected);
+
+	BufferSink::Reset();
+	out << Dec(value, 12);
+	sprintf(expected, "%12lld", v);
+	Check(expected);
+
+	// operator<< takes int promoted value
+	BufferSink::Reset();
+	hexOut << value;
+	sprintf(expected, "%llx", (unsigned long long)value & (sizeof(T) < sizeof(int) && sizeof(int) < 4 ? 0xffffull : 0xffffffffull));
+	Check(expected);
+
+	BufferSink::Reset();
+	out << Hex(value, 8, FormatZeroPad);
+	sprintf(expected, "%08llx", (unsigned long long)value & (sizeof(T) < 4 ? 0xffffull : 0xffffffffull));
+	Check(expected);
+}
+
+typedef FixedPoint<int32_t, 16> Q16;
+typedef FixedPoint<int16_t, 8> Q8;
+
+template<uint8_t Decimals, class Fixed>
+void CheckFixed(Fixed value)
+{
+	const long long one = 1ll << Fixed::FractionalBits;
+	long long raw = value.Raw();
+	long long absRaw = raw < 0 ? -raw : raw;
+	long long scale = 1;
+	for(uint8_t i = 0; i < Decimals; i++)
+		scale *= 10;
+	// printf rounds exact ties to even, formater rounds them up
+	if((absRaw % one) * scale % one == one / 2)
+		return;
+
+	char expected[64];
+	BufferSink::Reset();
+	out << ::Fixed<Decimals>(value, 12, FormatZeroPad);
+	sprintf(expected, "%012.*f", Decimals, (double)raw / one);
+	Check(expected);
+}
+
+template<uint8_t Decimals, class T>
+void CheckScaled(T value)
+{
+	long long v = value;
+	long long absValue = v < 0 ? -v : v;
+	long long scale = 1;
+	for(uint8_t i = 0; i < Decimals; i++)
+		scale *= 10;
+
+	char expected[64];
+	if(Decimals)
+		sprintf(expected, "%s%lld.%0*lld", v < 0 ? "-" : "", absValue / scale, (int)Decimals, absValue % scale);
+	else
+		sprintf(expected, "%lld", v);
+	BufferSink::Reset();
+	out << Scaled<Decimals>(value);
+	Check(expected);
+}
+
+FORMAT_STRING(TempLabel, "T=");
+FORMAT_STRING(IdLabel, " C, id=0x");
+FORMAT_STRING(NameLabel, " name=");
+
+typedef Format<FmtStr<TempLabel>, FmtFixed<1, 6>, FmtStr<IdLabel>, FmtHex<4, FormatZeroPad>,
+	FmtStr<NameLabel>, FmtText, FmtChar> TempFormat;
+typedef Format<FmtDec<>, FmtChar, FmtDec<8, FormatZeroPad | FormatPlusSign>, FmtChar, FmtScaled<3, 0, FormatLeftAlign> > NumbersFormat;
+typedef Format<FmtStr<NameLabel> > LiteralFormat;
+
+void CheckFormat(uint32_t value)
+{
+	char expected[64];
+	Q16 temperature = Q16::FromRaw(value >> 8);
+	uint16_t id = (uint16_t)value;
+	BufferSink::Reset();
+	TempFormat::Write(out, temperature, id, "sensor", '!');
+	sprintf(expected, "T=%6.1f C, id=0x%04x name=sensor!", (double)temperature.Raw() / 65536, id);
+	// skip exact ties, printf rounds them to even
+	if(((temperature.Raw() & 0xffff) * 10 & 0xffff) != 0x8000)
+		Check(expected);
+
+	int32_t v = (int32_t)value;
+	int16_t s = (int16_t)value;
+	BufferSink::Reset();
+	NumbersFormat::Write(out, v, ' ', s, ' ', v);
+	long long a = v < 0 ? -(long long)v : v;
+	sprintf(expected, "%ld %+08d %s%lld.%03lld", (long)v, s, v < 0 ? "-" : "", a / 1000, a % 1000);
+	Check(expected);
+}
+
+template<class T>
+long long RawValue(T value)
+{
+	return value;
+}
+
+template<class T, uint8_t FracBits>
+long long RawValue(FixedPoint<T, FracBits> value)
+{
+	return value.Raw();
+}
+
+template<class T>
+void CheckParse(const char *text, uint8_t error, T expected)
+{
+	T value = T();
+	StringSource::Set(text);
+	uint8_t result = in.ReadNumber(value);
+	if(result != error || (error == ParseOk && value != expected))
+	{
+		if(errors < 10)
+			printf("parse '%s': error %u, value %lld\n", text, result, RawValue(value));
+		errors++;
+	}
+}
+
+template<class T>
+void CheckRoundTrip(T value)
+{
+	BufferSink::Reset();
+	out << Dec(value) << " ";
+	CheckParse(BufferSink::Str(), ParseOk, value);
+}
+
+void CheckParser()
+{
+	CheckParse<int>("  123 ", ParseOk, 123);
+	CheckParse<int>("\r\n-42,", ParseOk, -42);
+	CheckParse<int>("+7;", ParseOk, 7);
+	CheckParse<int>("0x7fff ", ParseOk, 0x7fff);
+	CheckParse<int16_t>("0xffff ", ParseOk, -1);
+	CheckParse<int16_t>("-0x8000 ", ParseOk, -32768);
+	CheckParse<int16_t>("32767 ", ParseOk, 32767);
+	CheckParse<int16_t>("-32768 ", ParseOk, -32768);
+	CheckParse<int16_t>("32768 ", ParseOverflow, 0);
+	CheckParse<int16_t>("-32769 ", ParseOverflow, 0);
+	CheckParse<uint16_t>("65535 ", ParseOk, 65535);
+	CheckParse<uint16_t>("65536 ", ParseOverflow, 0);
+	CheckParse<uint16_t>("-1 ", ParseOverflow, 0);
+	CheckParse<uint8_t>("256 ", ParseOverflow, 0);
+	CheckParse<int8_t>("-128 ", ParseOk, -128);
+	CheckParse<uint32_t>("4294967295 ", ParseOk, 4294967295u);
+	CheckParse<uint32_t>("4294967296 ", ParseOverflow, 0);
+	CheckParse<uint32_t>("99999999999999999999 ", ParseOverflow, 0);
+	CheckParse<int32_t>("-2147483648 ", ParseOk, -2147483647 - 1);
+	CheckParse<int32_t>("2147483648 ", ParseOverflow, 0);
+	CheckParse<uint32_t>("0xFFFFFFFF ", ParseOk, 0xffffffffu);
+	CheckParse<uint32_t>("0x100000000 ", ParseOverflow, 0);
+	CheckParse<int>("12a ", ParseInvalidChar, 0);
+	CheckParse<int>("- ", ParseNoDigits, 0);
+	CheckParse<int>("0x ", ParseNoDigits, 0);
+	CheckParse<int>("1.5 ", ParseFraction, 0);
+	CheckParse<int>("0 ", ParseOk, 0);
+	CheckParse<int>("-0 ", ParseOk, 0);
+
+	// error skips the token, next number is read
+	StringSource::Set("12z34 56 ");
+	int value = 0;
+	if(in.ReadNumber(value) != ParseInvalidChar || in.ReadNumber(value) != ParseOk || value != 56)
+		printf("parse resync failed\n"), errors++;
+
+	// hex formater
+	unsigned hex = 0;
+	StringSource::Set("beef ");
+	hexIn >> hex;
+	if(hex != 0xbeef)
+		printf("hex parse: %x\n", hex), errors++;
+
+	CheckParse("1.5 ", ParseOk, Q16::FromRatio(3, 2));
+	CheckParse("-0.25 ", ParseOk, Q16::FromRatio(-1, 4));
+	CheckParse(".5 ", ParseOk, Q16::FromRatio(1, 2));
+	CheckParse("3 ", ParseOk, Q16::FromInt(3));
+	CheckParse("32768 ", ParseOverflow, Q16());
+	CheckParse("127.99 ", ParseOk, Q8::FromRaw(32765));
+	CheckParse("128 ", ParseOverflow, Q8());
+	CheckParse("-128 ", ParseOk, Q8::FromInt(-128));
+	CheckParse("-128.01 ", ParseOverflow, Q8());
+	CheckParse("0.123456 ", ParseOk, Q16::FromRaw(8087));
+
+	// printed fixed point values read back to the same raw value
+	for(unsigned i = 0; i < 100000; i++)
+	{
+		Q8 v = Q8::FromRaw((int16_t)rand());
+		BufferSink::Reset();
+		out << Fixed<4>(v) << ";";
+		CheckParse(BufferSink::Str(), ParseOk, v);
+	}
+}
+
+uint32_t Random32()
+{
+	uint32_t value = ((uint32_t)rand() << 16) ^ rand();
+	// uniform number of digits rather than uniform values
+	return value >> (rand() % 32);
+}
+
+double Elapsed(clock_t start, unsigned count)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / count;
+}
+
+int main()
+{
+	const uint32_t edges[] = {0, 1, 9, 10, 99, 100, 999, 1000, 9999, 10000, 65535, 65536,
+		99999, 100000, 999999999, 1000000000, 2863311539u, 4294967289u, 4294967295u};
+	for(unsigned i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+	{
+		CheckValue(edges[i]);
+		CheckValue((int32_t)edges[i]);
+		CheckValue((uint16_t)edges[i]);
+		CheckValue((int16_t)edges[i]);
+	}
+	for(unsigned i = 0; i < 1000000; i++)
+	{
+		uint32_t value = Random32();
+		CheckValue(value);
+		CheckValue((int32_t)value);
+		CheckValue((int16_t)value);
+	}
+	for(unsigned i = 0; i < 1000000; i++)
+	{
+		uint32_t value = Random32();
+		CheckFixed<0>(Q16::FromRaw(value));
+		CheckFixed<2>(Q16::FromRaw(value));
+		CheckFixed<4>(Q16::FromRaw(value));
+		CheckFixed<2>(Q8::FromRaw(value));
+		CheckScaled<0>((int32_t)value);
+		CheckScaled<3>((int32_t)value);
+		CheckScaled<9>((int32_t)value);
+		CheckScaled<2>((int16_t)value);
+	}
+	BufferSink::Reset();
+	out << (Q16::FromInt(3) * Q16::FromRatio(1, 3) - Q16::FromRatio(1, 2));
+	Check("0.50");
+	BufferSink::Reset();
+	LiteralFormat::Write(out);
+	Check(" name=");
+	for(unsigned i = 0; i < 100000; i++)
+		CheckFormat(Random32());
+
+	BlockSink::writes = 0;
+	BufferSink::Reset();
+	Statement(blockOut) << "id=" << 1234 << Hex(0xbeefu, 6, FormatZeroPad) << " " << Q16::FromRatio(-1, 4);
+	Check("id=123400beef -0.25");
+	if(BlockSink::writes != 1)
+		printf("statement: %u block writes\n", BlockSink::writes), errors++;
+	BufferSink::Reset();
+	blockOut << "0123456789012345678901234567890123456789\n";
+	Check("0123456789012345678901234567890123456789\n");
+	if(BlockSink::writes != 3 || BlockOut::Buffered() != 0)
+		printf("long line: %u block writes\n", BlockSink::writes), errors++;
+	BufferSink::Reset();
+	putchOut << "0123456789012345678901234567890123456789\n";
+	Check("01234567890123456789012345678901");
+	putchOut.Flush();
+	Check("0123456789012345678901234567890123456789\n");
+
+	CheckParser();
+	for(unsigned i = 0; i < 1000000; i++)
+	{
+		uint32_t value = Random32();
+		CheckRoundTrip(value);
+		CheckRoundTrip((int32_t)value);
+		CheckRoundTrip((int16_t)value);
+	}
+	printf("check: %u errors\n", errors);
+
+	const unsigned count = 4000000;
+	uint32_t *values = new uint32_t[count];
+	for(unsigned i = 0; i < count; i++)
+		values[i] = Random32();
+
+	char buffer[16];
+	unsigned sum = 0;
+	clock_t start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		snprintf(buffer, sizeof(buffer), "%lu", (unsigned long)values[i]);
+		sum += buffer[0];
+	}
+	printf("snprintf:        %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+		sum += DivisionLoop(values[i], buffer, 10)[0];
+	printf("division loop:   %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+		sum += *NumberFormat<10>::Unsigned(values[i], buffer + sizeof(buffer));
+	printf("NumberFormat:    %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		BufferSink::Reset();
+		out << values[i];
+		sum += *BufferSink::Str();
+	}
+	printf("TextFormater:    %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		BufferSink::Reset();
+		out << Dec(values[i], 10, FormatZeroPad);
+		sum += *BufferSink::Str();
+	}
+	printf("TextFormater 0N: %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		snprintf(buffer, sizeof(buffer), "%.2f", (int32_t)values[i] / 65536.0);
+		sum += buffer[0];
+	}
+	printf("snprintf %%.2f:   %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		BufferSink::Reset();
+		out << Q16::FromRaw(values[i]);
+		sum += *BufferSink::Str();
+	}
+	printf("Q16.16 2 digits: %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		snprintf(buffer, sizeof(buffer), "id=0x%04x", (unsigned)(uint16_t)values[i]);
+		sum += buffer[0];
+	}
+	printf("snprintf format: %6.1f ns/value\n", Elapsed(start, count));
+
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		BufferSink::Reset();
+		Format<FmtStr<IdLabel>, FmtHex<4, FormatZeroPad> >::Write(out, (uint16_t)values[i]);
+		sum += *BufferSink::Str();
+	}
+	printf("Format:          %6.1f ns/value\n", Elapsed(start, count));
+
+	// sink calls per log line, each is a non inlined call on target
+	BufferSink::Reset();
+	out << "T=" << values[0] << " id=" << (values[0] & 0xfff) << " x=" << (values[0] >> 20) << "\n";
+	unsigned putchCalls = strlen(BufferSink::Str());
+	BlockSink::writes = 0;
+	BufferSink::Reset();
+	blockOut << "T=" << values[0] << " id=" << (values[0] & 0xfff) << " x=" << (values[0] >> 20) << "\n";
+	printf("log line:        %u Putch calls, %u buffered block writes\n", putchCalls, BlockSink::writes);
+
+	// input: Gets + atol as before, and streaming parser
+	char *text = new char[count * 12 + 1], *pos = text;
+	for(unsigned i = 0; i < count; i++)
+		pos += sprintf(pos, "%lu\n", (unsigned long)values[i]);
+	*pos = 0;
+
+	StringSource::Set(text);
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		in.Gets(buffer, 11);
+		sum += atol(buffer);
+	}
+	printf("Gets + atol:     %6.1f ns/value\n", Elapsed(start, count));
+
+	StringSource::Set(text);
+	start = clock();
+	for(unsigned i = 0; i < count; i++)
+	{
+		unsigned long value = 0;
+		in >> value;
+		sum += value;
+	}
+	printf("operator>>:      %6.1f ns/value\n", Elapsed(start, count));
+
+	delete[] text;
+	delete[] values;
+	return errors != 0 || sum == 0;
+}
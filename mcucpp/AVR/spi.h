@@ -1,5 +1,7 @@
 
 #include <avr/io.h>
+#include "containers.h"
+#include "atomic.h"
 
 class Spi
 {
@@ -36,4 +38,128 @@ class Spi
 		while(!(SPSR & (1<<SPIF)));
 		return SPDR;
 	}
-};
\ No newline at end of file
+};
+
+struct SpiTransaction;
+
+// Asserts (select == true) or releases chip select line of the slave device.
+typedef void (*SpiSelectFunc)(bool select);
+// Called from SPI interrupt context when the transaction is finished.
+typedef void (*SpiCallback)(SpiTransaction *transaction);
+
+struct SpiTransaction
+{
+	SpiSelectFunc chipSelect;	// may be 0 if no chip select is needed
+	const uint8_t *txBuffer;	// if 0, zeros are sent
+	uint8_t *rxBuffer;			// if 0, recived data is discarded
+	uint16_t length;
+	SpiCallback callback;		// may be 0
+};
+
+// Adapts active low chip select pin to SpiSelectFunc.
+template<class Pin>
+struct SpiSelectPin
+{
+	static void Select(bool select)
+	{
+		if(select)
+			Pin::Clear();
+		else
+			Pin::Set();
+	}
+};
+
+// Interrupt driven SPI master with a queue of pending transactions.
+// Transactions are not copied, they must stay alive until the callback is called.
+// User code must call SpiAsync::IrqHandler() from ISR(SPI_STC_vect).
+// Spi::ReadWrite must not be used while the queue is not empty.
+template<int QueueSize = 4>
+class SpiAsync :public Spi
+{
+public:
+	static void Init(ClockDivider divider)
+	{
+		Spi::Init(divider);
+		_queue.Clear();
+		_current = 0;
+	}
+
+	// Queues the transaction. Returns false if the queue is full.
+	static bool Start(SpiTransaction *transaction)
+	{
+		bool result;
+		ATOMIC
+		{
+			result = _queue.Write(transaction);
+			if(result && !_current)
+				StartNext();
+		}
+		return result;
+	}
+
+	static bool IsBusy()
+	{
+		return _current != 0;
+	}
+
+	static void Wait()
+	{
+		while(_current);
+	}
+
+	static inline void IrqHandler()
+	{
+		SpiTransaction *transaction = _current;
+		uint8_t value = SPDR;
+
+		if(transaction->rxBuffer)
+			transaction->rxBuffer[_position] = value;
+
+		if(++_position != transaction->length)
+		{
+			SPDR = transaction->txBuffer ? transaction->txBuffer[_position] : 0;
+			return;
+		}
+
+		if(transaction->chipSelect)
+			transaction->chipSelect(false);
+		if(transaction->callback)
+			transaction->callback(transaction);
+		StartNext();
+	}
+
+private:
+	static void StartNext()
+	{
+		SpiTransaction *transaction;
+		while(_queue.Read(transaction))
+		{
+			if(transaction->length == 0)
+			{
+				if(transaction->callback)
+					transaction->callback(transaction);
+				continue;
+			}
+			_current = transaction;
+			_position = 0;
+			if(transaction->chipSelect)
+				transaction->chipSelect(true);
+			SPCR |= 1 << SPIE;
+			SPDR = transaction->txBuffer ? transaction->txBuffer[0] : 0;
+			return;
+		}
+		SPCR &= ~(1 << SPIE);
+		_current = 0;
+	}
+
+	static Queue<QueueSize, SpiTransaction*> _queue;
+	static SpiTransaction * volatile _current;
+	static uint16_t _position;
+};
+
+template<int QueueSize>
+	Queue<QueueSize, SpiTransaction*> SpiAsync<QueueSize>::_queue;
+template<int QueueSize>
+	SpiTransaction * volatile SpiAsync<QueueSize>::_current;
+template<int QueueSize>
+	uint16_t SpiAsync<QueueSize>::_position;
@@ -51,7 +51,16 @@ enum Registers
 	RxDataLength3		= 0x14,
 	RxDataLength4		= 0x15,
 	RxDataLength5		= 0x16,
-	FifoStatusReg  		= 0x17
+	FifoStatusReg  		= 0x17,
+	DynamicPayloadReg	= 0x1C,
+	FeatureReg			= 0x1D
+};
+
+enum FeatureValues
+{
+	EnableDynamicPayload	= 1 << 2,
+	EnableAckPayload		= 1 << 1,
+	EnableDynamicAck		= 1 << 0
 };
 
 
@@ -153,16 +162,28 @@ public:
 template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults = Rfm70Defaults>
 class Rfm70
 {
-private:
+protected:
+	// Shadow copy of bank 0 configuration registers (ConfigReg..RfSetupReg).
+	// They never change behind our back, so modifying them needs no SPI reads.
+	enum{ShadowRegsCount = RfSetupReg + 1};
+	static uint8_t _shadowRegs[ShadowRegsCount];
+	static bool _bank;
 
-	static void WriteReg(uint8_t reg, uint8_t value)
+	static void Command(uint8_t command, uint8_t value)
 	{
 		SlaveSelectPin::Clear();
-		Spi::ReadWrite(reg | WriteRegCmd);
+		Spi::ReadWrite(command);
 		Spi::ReadWrite(value);
 		SlaveSelectPin::Set();
 	}
 
+	static void WriteReg(uint8_t reg, uint8_t value)
+	{
+		if(reg < ShadowRegsCount && !_bank)
+			_shadowRegs[reg] = value;
+		Command(reg | WriteRegCmd, value);
+	}
+
 	static uint8_t ReadReg(uint8_t reg)
 	{ 
 		SlaveSelectPin::Clear();
@@ -174,7 +195,7 @@ private:
 
 	static void ModifyReg(uint8_t reg, uint8_t clearMask, uint8_t setMask)
 	{
-		uint8_t value = ReadReg(reg);
+		uint8_t value = reg < ShadowRegsCount && !_bank ? _shadowRegs[reg] : ReadReg(reg);
 		WriteReg(reg, (value & clearMask) | setMask);
 	}
 
@@ -254,13 +275,19 @@ private:
 
 	static void SwitchBank(bool bank)
 	{
-		bool isBank0 = (ReadReg(StatusReg) & RegBank) != 0;
-		if(bank != isBank0)		
+		if(bank != _bank)
 		{
-			WriteReg(ActivateCmd, 0x53);
+			Command(ActivateCmd, 0x53);
+			_bank = bank;
 		}
 	}
 
+	static void LoadShadowRegs()
+	{
+		for(uint8_t reg = 0; reg < ShadowRegsCount; reg++)
+			_shadowRegs[reg] = ReadReg(reg);
+	}
+
 	static void SetAddresess(uint8_t reg, uint32_t higherBytes, uint8_t lowerByte)
 	{
 		switch(Defaults::AddressWidth)
@@ -301,10 +328,12 @@ public:
 		
 		delay(50*1000u);
 		Activate();
+		_bank = (ReadReg(StatusReg) & RegBank) != 0;
 
 		InitBank1Regs();
 		
 		SwitchBank(0);
+		LoadShadowRegs();
 
 		WriteReg(ConfigReg, Defaults::Config | PowerUpBit);
 
@@ -343,11 +372,29 @@ public:
 		EnablePin::Set();
 	}
 
+	// Enables dynamic payload length on all pipes and payloads in ACK packets
+	static void EnableAckPayloads()
+	{
+		WriteReg(FeatureReg, EnableDynamicPayload | EnableAckPayload);
+		WriteReg(DynamicPayloadReg, 0x3f);
+	}
+
 	static void SetRfChannel(uint8_t channel)
 	{
 		WriteReg(RfChannelReg, channel);
 	}
 
+	static uint8_t RfChannel()
+	{
+		return _shadowRegs[RfChannelReg];
+	}
+
+	// Carrier detected on the current channel, valid in receive mode only
+	static bool CarrierDetected()
+	{
+		return ReadReg(CarrierDetectReg) & 1;
+	}
+
 	static void RfSetup(uint8_t rfSetup)
 	{
 		WriteReg(RfSetupReg, rfSetup);
@@ -355,17 +402,21 @@ public:
 	
 	static void FlushTx()
 	{
+		SlaveSelectPin::Clear();
 		Spi::ReadWrite(FlushTxCmd);
+		SlaveSelectPin::Set();
 	}
 	
 	static void FlushRx()
 	{
+		SlaveSelectPin::Clear();
 		Spi::ReadWrite(FlushRxCmd);
+		SlaveSelectPin::Set();
 	}
 	
 	static void Activate()
 	{
-		WriteReg(ActivateCmd, 0x73);
+		Command(ActivateCmd, 0x73);
 	}
 	
 	static uint8_t RecivedDataLength()
@@ -390,7 +441,7 @@ public:
 
 	static void ClearInterruptStatus()
 	{
-		ModifyReg(StatusReg, 0xff, 0);
+		WriteReg(StatusReg, RxDataReady | TxDataSent | MaxRetransmits);
 	}
 	
 	// Address for pipes 2-5
@@ -490,3 +541,8 @@ public:
 	}
 };
 
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults>
+	uint8_t Rfm70<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults>::_shadowRegs[ShadowRegsCount];
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults>
+	bool Rfm70<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults>::_bank;
@@ -0,0 +1,245 @@
+#pragma once
+
+#include "Rfm70Irq.h"
+
+// Carrier detect based spectrum scanner.
+// Keeps per channel occupancy: exponential average of carrier detect samples, 0..OccupancyMax.
+// The transiver must be in receive mode while scanning (Rfm70Irq listening).
+// Interrupts are disabled only for each register access, not for the settle delays,
+// Rfm70Irq::SetRfChannel does it by itself.
+template<class Transiver, uint8_t ChannelsCount = 84>
+class Rfm70ChannelScanner
+{
+	BOOST_STATIC_ASSERT(ChannelsCount > 1 && ChannelsCount <= 128);
+public:
+	enum
+	{
+		OccupancyMax = 240,
+		// delay() iterations to let PLL settle and carrier detect to sample a new channel (~200us)
+		CarrierDetectDelay = 400
+	};
+
+	static void Clear()
+	{
+		for(uint8_t i = 0; i < ChannelsCount; i++)
+			_occupancy[i] = 0;
+	}
+
+	// Samples carrier detect on every channel passes times. Current channel is restored.
+	static void Scan(uint8_t passes = 1)
+	{
+		uint8_t current = Transiver::RfChannel();
+		for(; passes; passes--)
+		{
+			for(uint8_t channel = 0; channel < ChannelsCount; channel++)
+			{
+				Transiver::SetRfChannel(channel);
+				delay(CarrierDetectDelay);
+				bool busy;
+				ATOMIC busy = Transiver::CarrierDetected();
+				Update(channel, busy);
+			}
+		}
+		Transiver::SetRfChannel(current);
+	}
+
+	static void Update(uint8_t channel, bool busy)
+	{
+		uint8_t occupancy = _occupancy[channel];
+		occupancy -= occupancy >> 3;
+		if(busy)
+			occupancy += OccupancyMax / 8;
+		_occupancy[channel] = occupancy;
+	}
+
+	static uint8_t Occupancy(uint8_t channel)
+	{
+		return _occupancy[channel];
+	}
+
+	// Least occupied channel, neighbour channels are taken into account
+	// since 2 Mbps transmission takes 2 MHz.
+	static uint8_t BestChannel(uint8_t exclude = 0xff)
+	{
+		uint8_t best = exclude == 0 ? 1 : 0;
+		uint16_t bestCost = 0xffff;
+		for(uint8_t channel = 0; channel < ChannelsCount; channel++)
+		{
+			if(channel == exclude)
+				continue;
+			uint16_t cost = _occupancy[channel] * 2;
+			cost += _occupancy[channel > 0 ? channel - 1 : channel];
+			cost += _occupancy[channel < ChannelsCount - 1 ? channel + 1 : channel];
+			if(cost < bestCost)
+			{
+				bestCost = cost;
+				best = channel;
+			}
+		}
+		return best;
+	}
+
+private:
+	static uint8_t _occupancy[ChannelsCount];
+};
+
+template<class Transiver, uint8_t ChannelsCount>
+	uint8_t Rfm70ChannelScanner<Transiver, ChannelsCount>::_occupancy[ChannelsCount];
+
+enum Rfm70HopRole
+{
+	Rfm70HopMaster,
+	Rfm70HopSlave
+};
+
+enum
+{
+	// [Rfm70HopFrame] [new channel], consumed by Rfm70Hopping, never seen by upper layers
+	Rfm70HopFrame = 0xC0,
+	// delay() iterations to let the slave send ACK for a hop frame before it switches
+	Rfm70HopAckDelay = 600
+};
+
+// Adaptive channel hopping for a pair of Rfm70Irq transivers.
+// The master samples carrier detect on its channel while listening and watches failed packets.
+// When the channel gets busy or a packet fails, it scans the band and announces the least
+// occupied channel to the slave with a hop frame, then both switch to it.
+// If the hop frame is not acknowledged, the master returns to the home channel (the channel
+// set by Init), the slave returns there as well after SilencePolls calls of Poll() without
+// recived packets, so the pair meets there again.
+// Rfm70Hopping hides Init, Send, Receive and Poll of the transiver, so it can be used
+// in place of it, e.g. Rfm70Link<Rfm70Hopping<Transiver, Rfm70HopMaster> >.
+// Poll() must be called from the main loop on both sides.
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold = 24,
+		uint16_t SilencePolls = 2000, uint8_t ChannelsCount = 84>
+class Rfm70Hopping :public Transiver
+{
+public:
+	typedef Rfm70ChannelScanner<Transiver, ChannelsCount> Scanner;
+
+	static void Init()
+	{
+		Transiver::Init();
+		_homeChannel = Transiver::RfChannel();
+		_failedPackets = Transiver::FailedPackets();
+		_silentPolls = 0;
+		_announcing = false;
+		_hops = 0;
+		Scanner::Clear();
+		if(Role == Rfm70HopMaster)
+			Scanner::Scan(4);
+	}
+
+	// Returns false while a hop is in progress
+	static bool Send(const void *buffer, uint8_t size)
+	{
+		if(_announcing)
+			return false;
+		return Transiver::Send(buffer, size);
+	}
+
+	static bool Receive(Rfm70Packet &packet)
+	{
+		while(Transiver::Receive(packet))
+		{
+			_silentPolls = 0;
+			if(packet.length != 2 || packet.data[0] != Rfm70HopFrame)
+				return true;
+			if(Role == Rfm70HopSlave && packet.data[1] < ChannelsCount)
+			{
+				delay(Rfm70HopAckDelay);
+				Transiver::SetRfChannel(packet.data[1]);
+			}
+		}
+		return false;
+	}
+
+	static void Poll()
+	{
+		Transiver::Poll();
+		if(Role == Rfm70HopMaster)
+			MasterPoll();
+		else
+			SlavePoll();
+	}
+
+	static uint8_t HomeChannel()
+	{
+		return _homeChannel;
+	}
+
+	// Number of channel changes made by the master
+	static uint8_t Hops()
+	{
+		return _hops;
+	}
+
+protected:
+	static void MasterPoll()
+	{
+		if(Transiver::State() != Rfm70Listening)
+			return;
+
+		uint8_t failed = Transiver::FailedPackets();
+		uint8_t channel = Transiver::RfChannel();
+		if(_announcing)
+		{
+			// hop frame is sent, switch if it is acknowledged
+			_announcing = false;
+			Transiver::SetRfChannel(failed == _failedPackets ? _nextChannel : _homeChannel);
+			_failedPackets = failed;
+			_hops++;
+			return;
+		}
+
+		bool busy;
+		ATOMIC busy = Transiver::CarrierDetected();
+		Scanner::Update(channel, busy);
+		bool lost = failed != _failedPackets;
+		if(!lost && Scanner::Occupancy(channel) < BusyThreshold)
+			return;
+		_failedPackets = failed;
+
+		Scanner::Scan(2);
+		uint8_t next = Scanner::BestChannel(channel);
+		if(!lost && Scanner::Occupancy(next) + BusyThreshold / 2 > Scanner::Occupancy(channel))
+			return;
+
+		uint8_t hop[2] = {Rfm70HopFrame, next};
+		_nextChannel = next;
+		_announcing = Transiver::Send(hop, sizeof(hop));
+	}
+
+	static void SlavePoll()
+	{
+		if(_silentPolls < SilencePolls)
+			_silentPolls++;
+		else if(Transiver::RfChannel() != _homeChannel)
+			Transiver::SetRfChannel(_homeChannel);
+	}
+
+	static uint8_t _homeChannel;
+	static uint8_t _nextChannel;
+	static uint8_t _failedPackets;
+	static uint8_t _hops;
+	static uint16_t _silentPolls;
+	static bool _announcing;
+};
+
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold, uint16_t SilencePolls, uint8_t ChannelsCount>
+	uint8_t Rfm70Hopping<Transiver, Role, BusyThreshold, SilencePolls, ChannelsCount>::_homeChannel;
+
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold, uint16_t SilencePolls, uint8_t ChannelsCount>
+	uint8_t Rfm70Hopping<Transiver, Role, BusyThreshold, SilencePolls, ChannelsCount>::_nextChannel;
+
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold, uint16_t SilencePolls, uint8_t ChannelsCount>
+	uint8_t Rfm70Hopping<Transiver, Role, BusyThreshold, SilencePolls, ChannelsCount>::_failedPackets;
+
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold, uint16_t SilencePolls, uint8_t ChannelsCount>
+	uint8_t Rfm70Hopping<Transiver, Role, BusyThreshold, SilencePolls, ChannelsCount>::_hops;
+
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold, uint16_t SilencePolls, uint8_t ChannelsCount>
+	uint16_t Rfm70Hopping<Transiver, Role, BusyThreshold, SilencePolls, ChannelsCount>::_silentPolls;
+
+template<class Transiver, Rfm70HopRole Role, uint8_t BusyThreshold, uint16_t SilencePolls, uint8_t ChannelsCount>
+	bool Rfm70Hopping<Transiver, Role, BusyThreshold, SilencePolls, ChannelsCount>::_announcing;
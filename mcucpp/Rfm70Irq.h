@@ -0,0 +1,281 @@
+#pragma once
+
+#include <atomic.h>
+#include "Rfm70.h"
+#include "containers.h"
+
+enum{Rfm70MaxPayload = 32};
+
+struct Rfm70Packet
+{
+	uint8_t pipe;
+	uint8_t length;
+	uint8_t data[Rfm70MaxPayload];
+};
+
+enum Rfm70State
+{
+	Rfm70PoweredDown,
+	Rfm70Listening,
+	Rfm70Transmitting
+};
+
+// Event driven Rfm70 driver.
+// IrqHandler() must be called from the IrqPin interrupt handler (falling edge),
+// or Poll() from the main loop if IrqPin is not connected to an interrupt source.
+// Recived payloads are put to the receive queue right from the interrupt handler,
+// packets from the send queue are loaded to TX FIFO as soon as there is a free slot.
+// The transiver listens while there is nothing to send.
+// Base class methods must not be called from the main loop after Init()
+// without disabling the IrqPin interrupt.
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin,
+		class Defaults = Rfm70Defaults, int RxQueueSize = 4, int TxQueueSize = 4>
+class Rfm70Irq :public Rfm70<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults>
+{
+	typedef Rfm70<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults> Base;
+public:
+
+	static void Init()
+	{
+		Base::Init();
+		_rxQueue.Clear();
+		_txQueue.Clear();
+		_lostPackets = 0;
+		_failedPackets = 0;
+		_txFifoCount = 0;
+		_ackPayload.length = 0;
+		Base::FlushRx();
+		Base::FlushTx();
+		Base::ClearInterruptStatus();
+		EnterListening();
+	}
+
+	// Queues a payload for sending. Returns false if the send queue is full.
+	static bool Send(const void *buffer, uint8_t size)
+	{
+		if(size > Rfm70MaxPayload)
+			return false;
+
+		Rfm70Packet packet;
+		packet.pipe = 0;
+		packet.length = size;
+		for(uint8_t i = 0; i < size; i++)
+			packet.data[i] = ((const uint8_t*)buffer)[i];
+
+		bool result;
+		ATOMIC
+		{
+			result = _txQueue.Write(packet);
+			if(result && _state == Rfm70Listening)
+				EnterTransmitting();
+		}
+		return result;
+	}
+
+	// Sets payload to be sent back in every ACK packet on the given pipe while listening.
+	// Requires EnableAckPayloads(). Zero size disables ACK payload.
+	static void SetAckPayload(uint8_t pipe, const void *buffer, uint8_t size)
+	{
+		ATOMIC
+		{
+			_ackPayload.pipe = pipe;
+			_ackPayload.length = size;
+			for(uint8_t i = 0; i < size; i++)
+				_ackPayload.data[i] = ((const uint8_t*)buffer)[i];
+			if(_state == Rfm70Listening)
+				LoadAckPayload();
+		}
+	}
+
+	// Gets the next recived payload. Returns false if the receive queue is empty.
+	static bool Receive(Rfm70Packet &packet)
+	{
+		// the packet is copied in many steps, the IRQ handler writes the same queue
+		bool result;
+		ATOMIC result = _rxQueue.Read(packet);
+		return result;
+	}
+
+	static void PowerDown()
+	{
+		ATOMIC
+		{
+			EnablePin::Clear();
+			Base::PowerDown();
+			_state = Rfm70PoweredDown;
+		}
+	}
+
+	static void PowerUp()
+	{
+		ATOMIC
+		{
+			Base::PowerUp();
+			// returns to listening right away if there is nothing to send
+			EnterTransmitting();
+		}
+	}
+
+	// Changes RF channel keeping the current mode
+	static void SetRfChannel(uint8_t channel)
+	{
+		ATOMIC
+		{
+			EnablePin::Clear();
+			Base::SetRfChannel(channel);
+			if(_state != Rfm70PoweredDown)
+				EnablePin::Set();
+		}
+	}
+
+	static Rfm70State State()
+	{
+		return _state;
+	}
+
+	// Number of recived payloads dropped due to the receive queue overflow
+	static uint8_t LostPackets()
+	{
+		return _lostPackets;
+	}
+
+	// Number of payloads dropped after max retransmit count is reached:
+	// the failed one and the ones queued behind it in TX FIFO, which are flushed with it
+	static uint8_t FailedPackets()
+	{
+		return _failedPackets;
+	}
+
+	static void Poll()
+	{
+		if(!IrqPin::IsSet())
+		{
+			ATOMIC IrqHandler();
+		}
+	}
+
+	static void IrqHandler()
+	{
+		uint8_t status = Base::ReadReg(StatusReg);
+		Base::WriteReg(StatusReg, status & (RxDataReady | TxDataSent | MaxRetransmits));
+
+		if(status & RxDataReady)
+			DrainRx();
+
+		if(_state == Rfm70Transmitting && (status & TxDataSent) && _txFifoCount)
+			_txFifoCount--;
+
+		if(status & MaxRetransmits)
+		{
+			Base::FlushTx();
+			_failedPackets += _txFifoCount ? _txFifoCount : 1;
+			_txFifoCount = 0;
+		}
+
+		if(_state == Rfm70Transmitting && (status & (TxDataSent | MaxRetransmits)))
+			FillTx();
+		else if(_state == Rfm70Listening && (status & TxDataSent))
+			LoadAckPayload();
+	}
+
+protected:
+	static void DrainRx()
+	{
+		Rfm70Packet packet;
+		while(!(Base::ReadReg(FifoStatusReg) & FifoRxEmpty))
+		{
+			packet.pipe = (Base::ReadReg(StatusReg) & RxPipeNumberMask) >> RxPipeNumberShift;
+			packet.length = Base::RecivedDataLength();
+			if(packet.length > Rfm70MaxPayload)
+			{
+				// corrupted payload length
+				Base::FlushRx();
+				return;
+			}
+			Base::ReadBuffer(ReadRxDataCmd, packet.data, packet.length);
+			if(!_rxQueue.Write(packet))
+				_lostPackets++;
+		}
+	}
+
+	// Keeps TX FIFO filled, returns to listening mode when everything is sent.
+	// _txFifoCount follows the packets in TX FIFO: one TxDataSent per packet
+	// if the handler keeps up with the interrupts, resynchronized whenever FIFO is empty.
+	static void FillTx()
+	{
+		Rfm70Packet packet;
+		while(true)
+		{
+			uint8_t fifoStatus = Base::ReadReg(FifoStatusReg);
+			if(fifoStatus & FifoTxEmpty)
+				_txFifoCount = 0;
+			if(fifoStatus & FifoTxFull)
+				return;
+			if(!_txQueue.Read(packet))
+			{
+				if(fifoStatus & FifoTxEmpty)
+					EnterListening();
+				return;
+			}
+			Base::WriteBuffer(WriteTxDataCmd, packet.data, packet.length);
+			_txFifoCount++;
+		}
+	}
+
+	// In listening mode TX FIFO holds only ACK payload, replace it with the actual one.
+	static void LoadAckPayload()
+	{
+		Base::FlushTx();
+		if(_ackPayload.length)
+			Base::WriteBuffer(WriteAckDataCmd | _ackPayload.pipe, _ackPayload.data, _ackPayload.length);
+	}
+
+	static void EnterTransmitting()
+	{
+		EnablePin::Clear();
+		Base::FlushTx();
+		_txFifoCount = 0;
+		Base::ModifyReg(ConfigReg, ~TxModeBit, 0);
+		_state = Rfm70Transmitting;
+		FillTx();
+		EnablePin::Set();
+	}
+
+	static void EnterListening()
+	{
+		EnablePin::Clear();
+		Base::ModifyReg(ConfigReg, 0xff, TxModeBit);
+		_state = Rfm70Listening;
+		LoadAckPayload();
+		EnablePin::Set();
+	}
+
+	static Queue<RxQueueSize, Rfm70Packet> _rxQueue;
+	static Queue<TxQueueSize, Rfm70Packet> _txQueue;
+	static Rfm70Packet _ackPayload;
+	static volatile Rfm70State _state;
+	static uint8_t _lostPackets;
+	static uint8_t _failedPackets;
+	static uint8_t _txFifoCount;
+};
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	Queue<RxQueueSize, Rfm70Packet> Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_rxQueue;
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	Queue<TxQueueSize, Rfm70Packet> Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_txQueue;
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	Rfm70Packet Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_ackPayload;
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	volatile Rfm70State Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_state;
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	uint8_t Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_lostPackets;
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	uint8_t Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_failedPackets;
+
+template<class Spi, class SlaveSelectPin, class EnablePin, class IrqPin, class Defaults, int RxQueueSize, int TxQueueSize>
+	uint8_t Rfm70Irq<Spi, SlaveSelectPin, EnablePin, IrqPin, Defaults, RxQueueSize, TxQueueSize>::_txFifoCount;
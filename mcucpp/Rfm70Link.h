@@ -0,0 +1,359 @@
+#pragma once
+
+#include "Rfm70Irq.h"
+
+// Frame layout:
+//  data fragment:	[message id (0..127)] [fragment index | LinkLastFragment] [data...]
+//  credit frame:	[LinkCreditFrame] [free reassembly buffers] [last started message id]
+//  probe frame:	[LinkProbeFrame]
+// Credit frames are sent back by the receiver as ACK payloads.
+// Probe frames carry no data, they are used by the sender to get a fresh credit frame.
+// Frames starting with 0xC0 are reserved for Rfm70Hopping.
+enum
+{
+	LinkControlFrame	= 0x80,
+	LinkCreditFrame		= 0x80,
+	LinkProbeFrame		= 0x81,
+	LinkLastFragment	= 0x80,
+	LinkMessageIdMask	= 0x7f,
+	LinkHeaderSize		= 2,
+	LinkFragmentSize	= Rfm70MaxPayload - LinkHeaderSize
+};
+
+struct Rfm70LinkMessage
+{
+	uint8_t *data;
+	uint16_t length;
+	uint8_t pipe;
+	uint8_t slot;
+};
+
+// Less time between retransmits and 2 Mbps data rate for bulk transfers.
+// Credit frames are short enough for 250us retransmit delay at 2 Mbps.
+class Rfm70FastDefaults :public Rfm70Defaults
+{
+public:
+	static const uint8_t RfSetup 	= DataRate2Mbps | OutputPower5dBm | LnaHighGain;
+	static const uint8_t RetrySetrup = Wait250us | 15;
+};
+
+// Link layer for messages longer than Rfm70 FIFO.
+// Messages are split to fragments that are streamed to the transiver
+// send queue, so TX FIFO is kept full and fragments are sent back to back.
+// The receiver reassembles messages in a pool of PoolSize buffers and reports
+// number of free buffers to the sender in ACK payloads of the AckPipe.
+// The sender starts a new message only if the receiver has a free buffer for it.
+// Transiver is a Rfm70Irq instance. Poll() must be called from the main loop.
+template<class Transiver, int MaxMessageSize = 256, int PoolSize = 2, uint8_t AckPipe = 0>
+class Rfm70Link
+{
+	BOOST_STATIC_ASSERT(MaxMessageSize <= LinkFragmentSize * 128);
+	// ids are compared modulo 128, so messages in flight must stay within half of the id space
+	BOOST_STATIC_ASSERT(PoolSize > 0 && PoolSize < 64);
+
+	enum SlotState
+	{
+		SlotFree,
+		SlotReceiving,
+		SlotComplete,
+		SlotDelivered
+	};
+
+	struct Slot
+	{
+		uint8_t state;
+		uint8_t pipe;
+		uint8_t message;
+		uint8_t nextFragment;
+		uint16_t length;
+		uint8_t data[MaxMessageSize];
+	};
+
+	struct TxState
+	{
+		const uint8_t *data;
+		uint16_t size;
+		uint16_t offset;
+		uint8_t fragment;
+		uint8_t message;
+		uint8_t nextMessage;
+		uint8_t failedPackets;
+		bool failed;
+		bool result;
+		bool creditValid;
+		uint8_t remoteFree;
+		uint8_t remoteLastMessage;
+	};
+
+public:
+	static void Init()
+	{
+		Transiver::Init();
+		ATOMIC Transiver::EnableAckPayloads();
+
+		for(uint8_t i = 0; i < PoolSize; i++)
+			_slots[i].state = SlotFree;
+		_lastMessage = LinkMessageIdMask;
+		_droppedMessages = 0;
+
+		_tx.data = 0;
+		_tx.nextMessage = 0;
+		_tx.result = true;
+		_tx.creditValid = false;
+		UpdateCredits();
+	}
+
+	// Starts sending of the message. Data buffer must stay valid while IsSending() is true.
+	// Returns false if previous message is not sent yet, or the receiver has no free buffer.
+	// In the last case a probe frame is sent to update credits, so the call should be retried later.
+	static bool Send(const void *data, uint16_t size)
+	{
+		if(_tx.data || size == 0 || size > MaxMessageSize)
+			return false;
+
+		if(Credits() == 0)
+		{
+			Probe();
+			return false;
+		}
+
+		_tx.data = (const uint8_t *)data;
+		_tx.size = size;
+		_tx.offset = 0;
+		_tx.fragment = 0;
+		_tx.message = _tx.nextMessage;
+		_tx.nextMessage = (_tx.nextMessage + 1) & LinkMessageIdMask;
+		_tx.failedPackets = Transiver::FailedPackets();
+		_tx.failed = false;
+		PumpTx();
+		return true;
+	}
+
+	static bool IsSending()
+	{
+		return _tx.data != 0;
+	}
+
+	// Result of the last finished Send
+	static bool LastSendSucceeded()
+	{
+		return _tx.result;
+	}
+
+	// Gets the next complete message. Message buffer must be returned with Release().
+	static bool Receive(Rfm70LinkMessage &message)
+	{
+		for(uint8_t i = 0; i < PoolSize; i++)
+		{
+			if(_slots[i].state == SlotComplete)
+			{
+				_slots[i].state = SlotDelivered;
+				message.data = _slots[i].data;
+				message.length = _slots[i].length;
+				message.pipe = _slots[i].pipe;
+				message.slot = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void Release(const Rfm70LinkMessage &message)
+	{
+		FreeSlot(_slots[message.slot]);
+	}
+
+	// Number of incomplete or out of buffer messages dropped by the receiver
+	static uint8_t DroppedMessages()
+	{
+		return _droppedMessages;
+	}
+
+	static void Poll()
+	{
+		Rfm70Packet packet;
+		while(Transiver::Receive(packet))
+		{
+			if(packet.length == 0)
+				continue;
+			if(packet.data[0] & LinkControlFrame)
+			{
+				if(packet.data[0] == LinkCreditFrame && packet.length >= 3)
+				{
+					_tx.remoteFree = packet.data[1];
+					_tx.remoteLastMessage = packet.data[2];
+					_tx.creditValid = true;
+				}
+				continue;
+			}
+			if(packet.length >= LinkHeaderSize)
+				ProcessFragment(packet);
+		}
+		PumpTx();
+	}
+
+protected:
+	// Signed distance from id 'from' to id 'to' modulo 128
+	static int8_t IdDistance(uint8_t from, uint8_t to)
+	{
+		return int8_t((to - from) << 1) >> 1;
+	}
+
+	// Number of messages the receiver can accept, accounting messages it has not seen yet.
+	// The receiver may be one id ahead of the last started message: after a failure
+	// the id is reused and the receiver has already taken a buffer for it.
+	static uint8_t Credits()
+	{
+		if(!_tx.creditValid)
+			return 0;
+		int8_t inFlight = IdDistance(_tx.remoteLastMessage, _tx.nextMessage - 1);
+		if(inFlight < 0)
+			inFlight = 0;
+		return _tx.remoteFree > inFlight ? _tx.remoteFree - inFlight : 0;
+	}
+
+	static void Probe()
+	{
+		if(Transiver::State() == Rfm70Listening)
+		{
+			uint8_t probe = LinkProbeFrame;
+			Transiver::Send(&probe, 1);
+		}
+	}
+
+	static void PumpTx()
+	{
+		if(!_tx.data)
+			return;
+
+		if(Transiver::FailedPackets() != _tx.failedPackets)
+			_tx.failed = true;
+
+		while(!_tx.failed && _tx.offset < _tx.size)
+		{
+			uint8_t fragment[Rfm70MaxPayload];
+			uint16_t size = _tx.size - _tx.offset;
+			if(size > LinkFragmentSize)
+				size = LinkFragmentSize;
+
+			fragment[0] = _tx.message;
+			fragment[1] = _tx.fragment;
+			if(_tx.offset + size == _tx.size)
+				fragment[1] |= LinkLastFragment;
+			for(uint8_t i = 0; i < size; i++)
+				fragment[LinkHeaderSize + i] = _tx.data[_tx.offset + i];
+
+			if(!Transiver::Send(fragment, size + LinkHeaderSize))
+				return;
+			_tx.offset += size;
+			_tx.fragment++;
+		}
+
+		// wait while queued fragments are sent
+		if(Transiver::State() != Rfm70Listening)
+			return;
+
+		if(Transiver::FailedPackets() != _tx.failedPackets)
+			_tx.failed = true;
+
+		// reuse the message id, so that the receiver restarts its buffer
+		if(_tx.failed)
+			_tx.nextMessage = _tx.message;
+		_tx.result = !_tx.failed;
+		_tx.data = 0;
+	}
+
+	static Slot *FindSlot(uint8_t state, uint8_t pipe)
+	{
+		for(uint8_t i = 0; i < PoolSize; i++)
+		{
+			if(_slots[i].state == state && (state == SlotFree || _slots[i].pipe == pipe))
+				return &_slots[i];
+		}
+		return 0;
+	}
+
+	static void FreeSlot(Slot &slot)
+	{
+		slot.state = SlotFree;
+		UpdateCredits();
+	}
+
+	static void DropSlot(Slot &slot)
+	{
+		_droppedMessages++;
+		FreeSlot(slot);
+	}
+
+	static void ProcessFragment(const Rfm70Packet &packet)
+	{
+		uint8_t message = packet.data[0];
+		uint8_t fragment = packet.data[1] & ~LinkLastFragment;
+		Slot *slot = FindSlot(SlotReceiving, packet.pipe);
+
+		if(fragment == 0)
+		{
+			// previous message from this pipe is incomplete, or restarted
+			if(slot && slot->message != message)
+				_droppedMessages++;
+			if(!slot)
+				slot = FindSlot(SlotFree, packet.pipe);
+			if(!slot)
+			{
+				_droppedMessages++;
+				return;
+			}
+			slot->state = SlotReceiving;
+			slot->pipe = packet.pipe;
+			slot->message = message;
+			slot->nextFragment = 0;
+			slot->length = 0;
+			_lastMessage = message;
+			UpdateCredits();
+		}
+
+		if(!slot || slot->message != message)
+			return;
+
+		uint8_t size = packet.length - LinkHeaderSize;
+		if(slot->nextFragment != fragment || slot->length + size > MaxMessageSize)
+		{
+			DropSlot(*slot);
+			return;
+		}
+
+		for(uint8_t i = 0; i < size; i++)
+			slot->data[slot->length + i] = packet.data[LinkHeaderSize + i];
+		slot->length += size;
+		slot->nextFragment++;
+
+		if(packet.data[1] & LinkLastFragment)
+			slot->state = SlotComplete;
+	}
+
+	static void UpdateCredits()
+	{
+		uint8_t credit[3] = {LinkCreditFrame, 0, _lastMessage};
+		for(uint8_t i = 0; i < PoolSize; i++)
+			if(_slots[i].state == SlotFree)
+				credit[1]++;
+		Transiver::SetAckPayload(AckPipe, credit, sizeof(credit));
+	}
+
+	static Slot _slots[PoolSize];
+	static uint8_t _lastMessage;
+	static uint8_t _droppedMessages;
+	static TxState _tx;
+};
+
+template<class Transiver, int MaxMessageSize, int PoolSize, uint8_t AckPipe>
+	typename Rfm70Link<Transiver, MaxMessageSize, PoolSize, AckPipe>::Slot Rfm70Link<Transiver, MaxMessageSize, PoolSize, AckPipe>::_slots[PoolSize];
+
+template<class Transiver, int MaxMessageSize, int PoolSize, uint8_t AckPipe>
+	uint8_t Rfm70Link<Transiver, MaxMessageSize, PoolSize, AckPipe>::_lastMessage;
+
+template<class Transiver, int MaxMessageSize, int PoolSize, uint8_t AckPipe>
+	uint8_t Rfm70Link<Transiver, MaxMessageSize, PoolSize, AckPipe>::_droppedMessages;
+
+template<class Transiver, int MaxMessageSize, int PoolSize, uint8_t AckPipe>
+	typename Rfm70Link<Transiver, MaxMessageSize, PoolSize, AckPipe>::TxState Rfm70Link<Transiver, MaxMessageSize, PoolSize, AckPipe>::_tx;
@@ -0,0 +1,919 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <map>
+
+// Host side emulation of Rfm70 transivers connected through a virtual radio medium.
+// VirtualRfm70<Id> provides Spi and pin classes for Rfm70 template, e.g.:
+//	typedef VirtualRfm70<0> Radio;
+//	typedef Rfm70<Radio::Spi, Radio::SelectPin, Radio::EnablePin, Radio::IrqPin> Transiver;
+// Time is simulated, it is advanced with VirtualRf::Medium::Instance().Run(us).
+// Each SPI byte and each change of the select or enable pin advances it too
+// (SetBusTiming()), so MCU turnaround between radio operations is part of
+// the measured time. All drivers share one clock: bus time of several nodes
+// adds up as if a single MCU ran them.
+
+namespace VirtualRf
+{
+	enum
+	{
+		MaxPayload = 32,
+		FifoDepth = 3,
+		TxSettleTime = 130,	//us
+		DefaultSpiByteTime = 3,	//us, 8 bits at 4 MHz plus driver loop
+		DefaultPinChangeTime = 1,	//us
+		PacketOverhead = 1 + 2,	// preamble + 2 bytes of CRC, address is added separately
+		PcfBits = 9
+	};
+
+	struct Frame
+	{
+		uint8_t data[MaxPayload];
+		uint8_t length;
+		uint8_t pipe;
+		bool noAck;
+	};
+
+	// Time interval a transmission occupied a channel
+	struct AirRecord
+	{
+		uint8_t channel;
+		double start;
+		double end;
+		const void *source;
+	};
+
+	class Chip;
+
+	enum EventType
+	{
+		TxEndEvent,
+		FrameArriveEvent,
+		AckArriveEvent,
+		RetryTimeoutEvent
+	};
+
+	struct Event
+	{
+		EventType type;
+		Chip *chip;
+		Chip *source;
+		uint32_t attempt;
+		Frame frame;
+		uint8_t address[5];
+		uint8_t addressWidth;
+		uint8_t pid;
+		bool rate2Mbps;
+		bool hasAck;
+		AirRecord air;
+	};
+
+	struct MediumStats
+	{
+		uint32_t frames;
+		uint32_t lost;
+		uint32_t collisions;
+		uint32_t acks;
+		uint32_t acksLost;
+	};
+
+	class Medium
+	{
+	public:
+		static Medium &Instance()
+		{
+			static Medium medium;
+			return medium;
+		}
+
+		// Clears simulation state and resets all chips to power on state
+		void Reset();
+
+		// Probability of a frame (or ACK) to be lost
+		void SetLossRate(double lossRate)
+		{
+			_lossRate = lossRate;
+		}
+
+		// Propagation and processing latency added to each frame, us
+		void SetLatency(double latency)
+		{
+			_latency = latency;
+		}
+
+		// Interferer on the channel: frames are lost and carrier is detected
+		// with the given probability
+		void SetChannelNoise(uint8_t channel, double busyProbability)
+		{
+			if(channel < ChannelsCount)
+				_noise[channel] = busyProbability;
+		}
+
+		// MCU side time of one SPI byte and of one pin change, us
+		void SetBusTiming(double spiByteTime, double pinChangeTime)
+		{
+			_spiByteTime = spiByteTime;
+			_pinChangeTime = pinChangeTime;
+		}
+
+		double SpiByteTime()const
+		{
+			return _spiByteTime;
+		}
+
+		double PinChangeTime()const
+		{
+			return _pinChangeTime;
+		}
+
+		void SetSeed(uint32_t seed)
+		{
+			_random = seed;
+		}
+
+		double Now()const
+		{
+			return _now;
+		}
+
+		const MediumStats &Stats()const
+		{
+			return _stats;
+		}
+
+		// Advances simulated time
+		void Run(double us)
+		{
+			double until = _now + us;
+			while(!_events.empty() && _events.begin()->first <= until)
+			{
+				std::multimap<double, Event>::iterator i = _events.begin();
+				Event event = i->second;
+				_now = i->first;
+				_events.erase(i);
+				Dispatch(event);
+			}
+			_now = until;
+			PruneAir();
+		}
+
+		void Attach(Chip *chip)
+		{
+			_chips.push_back(chip);
+		}
+
+		void Schedule(double time, const Event &event)
+		{
+			_events.insert(std::make_pair(time, event));
+		}
+
+		void AddAir(const AirRecord &air)
+		{
+			_air.push_back(air);
+		}
+
+		bool Collides(const AirRecord &air)const
+		{
+			for(std::deque<AirRecord>::const_iterator i = _air.begin(); i != _air.end(); ++i)
+			{
+				if(i->source != air.source && i->channel == air.channel &&
+					i->start < air.end && i->end > air.start)
+					return true;
+			}
+			return false;
+		}
+
+		bool ChannelBusy(uint8_t channel, const void *self)
+		{
+			for(std::deque<AirRecord>::const_iterator i = _air.begin(); i != _air.end(); ++i)
+			{
+				if(i->source != self && i->channel == channel && i->start <= _now && i->end > _now)
+					return true;
+			}
+			return channel < ChannelsCount && Random() < _noise[channel];
+		}
+
+		bool Lost(uint8_t channel)
+		{
+			if(Random() < _lossRate)
+				return true;
+			return channel < ChannelsCount && Random() < _noise[channel];
+		}
+
+		double Latency()const
+		{
+			return _latency;
+		}
+
+		// Schedules frame arrival at all other chips
+		void Broadcast(Chip *source, const Event &event)
+		{
+			_stats.frames++;
+			for(std::vector<Chip*>::iterator i = _chips.begin(); i != _chips.end(); ++i)
+			{
+				if(*i == source)
+					continue;
+				Event arrive = event;
+				arrive.type = FrameArriveEvent;
+				arrive.chip = *i;
+				Schedule(_now + _latency, arrive);
+			}
+		}
+
+		MediumStats &MutableStats()
+		{
+			return _stats;
+		}
+
+		static double AirTime(uint8_t addressWidth, uint8_t length, bool rate2Mbps)
+		{
+			double bits = (PacketOverhead + addressWidth + length) * 8 + PcfBits;
+			return rate2Mbps ? bits / 2 : bits;
+		}
+
+	private:
+		enum{ChannelsCount = 128};
+
+		Medium()
+		{
+			_random = 1;
+			_lossRate = 0;
+			_latency = 0;
+			_spiByteTime = DefaultSpiByteTime;
+			_pinChangeTime = DefaultPinChangeTime;
+			_now = 0;
+			for(unsigned i = 0; i < ChannelsCount; i++)
+				_noise[i] = 0;
+			memset(&_stats, 0, sizeof(_stats));
+		}
+
+		double Random()
+		{
+			_random = _random * 1103515245u + 12345u;
+			return ((_random >> 8) & 0xffffff) / double(0x1000000);
+		}
+
+		void PruneAir()
+		{
+			while(!_air.empty() && _air.front().end < _now - 10000)
+				_air.pop_front();
+		}
+
+		void Dispatch(const Event &event);
+
+		std::vector<Chip*> _chips;
+		std::multimap<double, Event> _events;
+		std::deque<AirRecord> _air;
+		double _noise[ChannelsCount];
+		double _lossRate;
+		double _latency;
+		double _spiByteTime;
+		double _pinChangeTime;
+		double _now;
+		uint32_t _random;
+		MediumStats _stats;
+	};
+
+	struct ChipStats
+	{
+		uint32_t sent;
+		uint32_t retransmits;
+		uint32_t acked;
+		uint32_t failed;
+		uint32_t received;
+		uint32_t duplicates;
+		uint32_t overflows;
+		uint32_t spiBytes;
+	};
+
+	// Register level model of one Rfm70 chip
+	class Chip
+	{
+		enum Phase
+		{
+			Idle,
+			Transmitting,
+			WaitingAck
+		};
+
+		enum
+		{
+			Config			= 0x00,
+			EnAa			= 0x01,
+			EnRxAddr		= 0x02,
+			SetupAw			= 0x03,
+			SetupRetr		= 0x04,
+			RfCh			= 0x05,
+			RfSetup			= 0x06,
+			Status			= 0x07,
+			ObserveTx		= 0x08,
+			Cd				= 0x09,
+			RxAddrP0		= 0x0A,
+			RxAddrP1		= 0x0B,
+			TxAddr			= 0x10,
+			RxPwP0			= 0x11,
+			FifoStatus		= 0x17,
+			DynPd			= 0x1C,
+			Feature			= 0x1D,
+
+			PrimRx			= 1 << 0,
+			PwrUp			= 1 << 1,
+			RxDr			= 1 << 6,
+			TxDs			= 1 << 5,
+			MaxRt			= 1 << 4,
+			IrqFlags		= RxDr | TxDs | MaxRt,
+			RfDr			= 1 << 3,
+			EnDpl			= 1 << 2,
+			EnAckPay		= 1 << 1,
+
+			MaxCommandLength = 1 + MaxPayload
+		};
+
+	public:
+		Chip()
+		{
+			Reset();
+			Medium::Instance().Attach(this);
+		}
+
+		void Reset()
+		{
+			memset(_regs, 0, sizeof(_regs));
+			memset(_bank1, 0, sizeof(_bank1));
+			_regs[Config] = 0x08;
+			_regs[EnAa] = 0x3f;
+			_regs[EnRxAddr] = 0x03;
+			_regs[SetupAw] = 0x03;
+			_regs[SetupRetr] = 0x03;
+			_regs[RfCh] = 0x02;
+			_regs[RfSetup] = 0x0f;
+			for(uint8_t i = 0; i < 5; i++)
+			{
+				_rxAddr0[i] = 0xe7;
+				_rxAddr1[i] = 0xc2;
+				_txAddr[i] = 0xe7;
+			}
+			_regs[0x0C] = 0xc3;
+			_regs[0x0D] = 0xc4;
+			_regs[0x0E] = 0xc5;
+			_regs[0x0F] = 0xc6;
+			_status = 0;
+			_bank = false;
+			_featuresActive = false;
+			_ce = false;
+			_selected = false;
+			_phase = Idle;
+			_attempt = 0;
+			_retransmitCount = 0;
+			_lostCount = 0;
+			_pid = 0;
+			_txFifo.clear();
+			_rxFifo.clear();
+			for(uint8_t i = 0; i < 6; i++)
+				_lastPid[i] = 0xff;
+			memset(&_stats, 0, sizeof(_stats));
+		}
+
+		// SPI and pins interface
+		void Select(bool select)
+		{
+			if(select && !_selected)
+				_length = 0;
+			if(!select && _selected)
+				Commit();
+			_selected = select;
+		}
+
+		uint8_t Transfer(uint8_t value)
+		{
+			_stats.spiBytes++;
+			if(!_selected)
+				return 0xff;
+			uint8_t result;
+			if(_length == 0)
+				result = StatusValue();
+			else
+				result = ReadData(_length - 1);
+			if(_length < MaxCommandLength)
+				_command[_length++] = value;
+			return result;
+		}
+
+		void SetCe(bool ce)
+		{
+			_ce = ce;
+			Kick();
+		}
+
+		bool IrqAsserted()const
+		{
+			return (_status & IrqFlags & ~_regs[Config]) != 0;
+		}
+
+		const ChipStats &Stats()const
+		{
+			return _stats;
+		}
+
+		// medium interface
+		void OnEvent(const Event &event)
+		{
+			switch(event.type)
+			{
+				case TxEndEvent:		TxEnd(); break;
+				case FrameArriveEvent:	FrameArrive(event); break;
+				case AckArriveEvent:	AckArrive(event); break;
+				case RetryTimeoutEvent:	RetryTimeout(event); break;
+			}
+		}
+
+	private:
+		Medium &TheMedium()
+		{
+			return Medium::Instance();
+		}
+
+		uint8_t AddressWidth()const
+		{
+			return (_regs[SetupAw] & 3) + 2;
+		}
+
+		uint8_t Channel()const
+		{
+			return _regs[RfCh] & 0x7f;
+		}
+
+		bool Rate2Mbps()const
+		{
+			return (_regs[RfSetup] & RfDr) != 0;
+		}
+
+		bool DynamicPayload(uint8_t pipe)const
+		{
+			return _featuresActive && (_regs[Feature] & EnDpl) && (_regs[DynPd] & (1 << pipe));
+		}
+
+		bool IsListening()const
+		{
+			return (_regs[Config] & PwrUp) && (_regs[Config] & PrimRx) && _ce;
+		}
+
+		uint8_t StatusValue()const
+		{
+			uint8_t pipe = _rxFifo.empty() ? 7 : _rxFifo.front().pipe;
+			return (_bank ? 0x80 : 0) | _status | (pipe << 1) | (_txFifo.size() == FifoDepth ? 1 : 0);
+		}
+
+		uint8_t FifoStatusValue()const
+		{
+			return (_txFifo.size() == FifoDepth ? 0x20 : 0) |
+				(_txFifo.empty() ? 0x10 : 0) |
+				(_rxFifo.size() == FifoDepth ? 0x02 : 0) |
+				(_rxFifo.empty() ? 0x01 : 0);
+		}
+
+		uint8_t ReadRegister(uint8_t reg, uint8_t index)
+		{
+			if(_bank)
+				return index < sizeof(_bank1[0]) ? _bank1[reg][index] : 0;
+			switch(reg)
+			{
+				case RxAddrP0: return index < 5 ? _rxAddr0[index] : 0;
+				case RxAddrP1: return index < 5 ? _rxAddr1[index] : 0;
+				case TxAddr: return index < 5 ? _txAddr[index] : 0;
+				case Status: return StatusValue();
+				case FifoStatus: return FifoStatusValue();
+				case ObserveTx: return (_lostCount << 4) | _retransmitCount;
+				case Cd: return IsListening() && TheMedium().ChannelBusy(Channel(), this) ? 1 : 0;
+				case DynPd:
+				case Feature:
+					return _featuresActive ? _regs[reg] : 0;
+				default: return _regs[reg];
+			}
+		}
+
+		// Data returned for the (index + 1)th byte of the current command
+		uint8_t ReadData(uint8_t index)
+		{
+			uint8_t command = _command[0];
+			if(command < 0x20)
+				return ReadRegister(command & 0x1f, index);
+			if(command == 0x60)
+				return _rxFifo.empty() ? 0 : _rxFifo.front().length;
+			if(command == 0x61)
+				return !_rxFifo.empty() && index < _rxFifo.front().length ? _rxFifo.front().data[index] : 0;
+			return 0;
+		}
+
+		void WriteRegister(uint8_t reg, const uint8_t *data, uint8_t length)
+		{
+			if(length == 0)
+				return;
+			if(_bank)
+			{
+				for(uint8_t i = 0; i < length && i < sizeof(_bank1[0]); i++)
+					_bank1[reg][i] = data[i];
+				return;
+			}
+			switch(reg)
+			{
+				case RxAddrP0: memcpy(_rxAddr0, data, length < 5 ? length : 5); break;
+				case RxAddrP1: memcpy(_rxAddr1, data, length < 5 ? length : 5); break;
+				case TxAddr: memcpy(_txAddr, data, length < 5 ? length : 5); break;
+				case Status: _status &= ~(data[0] & IrqFlags); break;
+				case ObserveTx:
+				case Cd:
+				case FifoStatus:
+					break;
+				case RfCh:
+					_lostCount = 0;
+					_regs[reg] = data[0];
+					break;
+				case DynPd:
+				case Feature:
+					if(_featuresActive)
+						_regs[reg] = data[0];
+					break;
+				default:
+					_regs[reg] = data[0];
+			}
+		}
+
+		void Push(std::deque<Frame> &fifo, uint8_t pipe, bool noAck)
+		{
+			if(fifo.size() == FifoDepth || _length < 2)
+				return;
+			Frame frame;
+			frame.length = _length - 1;
+			memcpy(frame.data, _command + 1, frame.length);
+			frame.pipe = pipe;
+			frame.noAck = noAck;
+			fifo.push_back(frame);
+		}
+
+		void Commit()
+		{
+			if(_length == 0)
+				return;
+			uint8_t command = _command[0];
+			if(command >= 0x20 && command < 0x40)
+				WriteRegister(command & 0x1f, _command + 1, _length - 1);
+			else if(command == 0x61)
+			{
+				if(!_rxFifo.empty())
+					_rxFifo.pop_front();
+			}
+			else if(command == 0xA0)
+				Push(_txFifo, 0, false);
+			else if(command == 0xB0)
+				Push(_txFifo, 0, true);
+			else if((command & 0xF8) == 0xA8)
+			{
+				if(_featuresActive && (_regs[Feature] & EnAckPay))
+					Push(_txFifo, command & 7, false);
+			}
+			else if(command == 0xE1)
+				_txFifo.clear();
+			else if(command == 0xE2)
+				_rxFifo.clear();
+			else if(command == 0x50 && _length > 1)
+			{
+				if(_command[1] == 0x53)
+					_bank = !_bank;
+				else if(_command[1] == 0x73)
+					_featuresActive = !_featuresActive;
+			}
+			Kick();
+		}
+
+		// Starts transmission if PTX conditions are met
+		void Kick()
+		{
+			if(_phase != Idle || _txFifo.empty() || (_status & MaxRt) || !_ce ||
+				!(_regs[Config] & PwrUp) || (_regs[Config] & PrimRx))
+				return;
+			_retransmitCount = 0;
+			StartAir(TheMedium().Now() + TxSettleTime);
+		}
+
+		void StartAir(double start)
+		{
+			const Frame &frame = _txFifo.front();
+			_phase = Transmitting;
+			_attempt++;
+			_air.channel = Channel();
+			_air.start = start;
+			_air.end = start + Medium::AirTime(AddressWidth(), frame.length, Rate2Mbps());
+			_air.source = this;
+			TheMedium().AddAir(_air);
+
+			Event event;
+			event.type = TxEndEvent;
+			event.chip = this;
+			event.attempt = _attempt;
+			TheMedium().Schedule(_air.end, event);
+		}
+
+		bool ExpectsAck(const Frame &frame)const
+		{
+			return !frame.noAck && (_regs[EnAa] & 1) && (_regs[SetupRetr] & 0x0f);
+		}
+
+		void TxEnd()
+		{
+			if(_phase != Transmitting || _txFifo.empty())
+			{
+				_phase = Idle;
+				return;
+			}
+			const Frame &frame = _txFifo.front();
+			_stats.sent++;
+
+			Event event;
+			event.source = this;
+			event.attempt = _attempt;
+			event.frame = frame;
+			event.addressWidth = AddressWidth();
+			memcpy(event.address, _txAddr, 5);
+			event.pid = _pid;
+			event.rate2Mbps = Rate2Mbps();
+			event.hasAck = ExpectsAck(frame);
+			event.air = _air;
+			TheMedium().Broadcast(this, event);
+
+			if(!event.hasAck)
+			{
+				Sent();
+				return;
+			}
+
+			_phase = WaitingAck;
+			Event timeout;
+			timeout.type = RetryTimeoutEvent;
+			timeout.chip = this;
+			timeout.attempt = _attempt;
+			double delay = ((_regs[SetupRetr] >> 4) + 1) * 250;
+			TheMedium().Schedule(TheMedium().Now() + delay, timeout);
+		}
+
+		void Sent()
+		{
+			if(!_txFifo.empty())
+				_txFifo.pop_front();
+			_pid = (_pid + 1) & 3;
+			_status |= TxDs;
+			_phase = Idle;
+			_stats.acked++;
+			Kick();
+		}
+
+		int8_t MatchPipe(const uint8_t *address, uint8_t width)const
+		{
+			if(width != AddressWidth())
+				return -1;
+			if((_regs[EnRxAddr] & 1) && memcmp(address, _rxAddr0, width) == 0)
+				return 0;
+			if(memcmp(address + 1, _rxAddr1 + 1, width - 1) != 0)
+				return -1;
+			if((_regs[EnRxAddr] & 2) && address[0] == _rxAddr1[0])
+				return 1;
+			for(uint8_t pipe = 2; pipe < 6; pipe++)
+				if((_regs[EnRxAddr] & (1 << pipe)) && address[0] == _regs[RxAddrP0 + pipe])
+					return pipe;
+			return -1;
+		}
+
+		void FrameArrive(const Event &event)
+		{
+			if(!IsListening() || Channel() != event.air.channel || Rate2Mbps() != event.rate2Mbps)
+				return;
+			int8_t pipe = MatchPipe(event.address, event.addressWidth);
+			if(pipe < 0)
+				return;
+
+			MediumStats &mediumStats = TheMedium().MutableStats();
+			if(TheMedium().Collides(event.air))
+			{
+				mediumStats.collisions++;
+				return;
+			}
+			if(TheMedium().Lost(Channel()))
+			{
+				mediumStats.lost++;
+				return;
+			}
+			// static payload width mismatch fails CRC check
+			if(!DynamicPayload(pipe) && event.frame.length != _regs[RxPwP0 + pipe])
+				return;
+
+			bool autoAck = event.hasAck && (_regs[EnAa] & (1 << pipe));
+			if(_rxFifo.size() == FifoDepth)
+			{
+				// not acknowledged, sender will retransmit
+				_stats.overflows++;
+				return;
+			}
+
+			if(autoAck && _lastPid[pipe] == event.pid && _lastLength[pipe] == event.frame.length &&
+				memcmp(_lastData[pipe], event.frame.data, event.frame.length) == 0)
+			{
+				_stats.duplicates++;
+			}
+			else
+			{
+				Frame frame = event.frame;
+				frame.pipe = pipe;
+				_rxFifo.push_back(frame);
+				_status |= RxDr;
+				_stats.received++;
+				if(autoAck)
+				{
+					_lastPid[pipe] = event.pid;
+					_lastLength[pipe] = event.frame.length;
+					memcpy(_lastData[pipe], event.frame.data, event.frame.length);
+				}
+			}
+
+			if(!autoAck)
+				return;
+
+			Event ack;
+			ack.type = AckArriveEvent;
+			ack.chip = event.source;
+			ack.source = this;
+			ack.attempt = event.attempt;
+			ack.hasAck = false;
+			ack.frame.length = 0;
+			for(std::deque<Frame>::iterator i = _txFifo.begin(); i != _txFifo.end(); ++i)
+			{
+				if(i->pipe == pipe && (_regs[Feature] & EnAckPay))
+				{
+					ack.frame = *i;
+					ack.hasAck = true;
+					_txFifo.erase(i);
+					_status |= TxDs;
+					break;
+				}
+			}
+			memcpy(ack.address, event.address, 5);
+			ack.addressWidth = event.addressWidth;
+			ack.air.channel = Channel();
+			ack.air.start = TheMedium().Now() + TxSettleTime;
+			ack.air.end = ack.air.start + Medium::AirTime(ack.addressWidth, ack.frame.length, Rate2Mbps());
+			ack.air.source = this;
+			TheMedium().AddAir(ack.air);
+			TheMedium().Schedule(ack.air.end + TheMedium().Latency(), ack);
+			mediumStats.acks++;
+		}
+
+		void AckArrive(const Event &event)
+		{
+			if(_phase != WaitingAck || event.attempt != _attempt)
+				return;
+			MediumStats &mediumStats = TheMedium().MutableStats();
+			if(TheMedium().Collides(event.air) || TheMedium().Lost(Channel()))
+			{
+				mediumStats.acksLost++;
+				return;
+			}
+			// ACK is recived on pipe 0, its address must match TX address
+			if(!(_regs[EnRxAddr] & 1) || memcmp(_rxAddr0, event.address, event.addressWidth) != 0)
+				return;
+			if(event.hasAck && _rxFifo.size() < FifoDepth)
+			{
+				Frame frame = event.frame;
+				frame.pipe = 0;
+				_rxFifo.push_back(frame);
+				_status |= RxDr;
+			}
+			Sent();
+		}
+
+		void RetryTimeout(const Event &event)
+		{
+			if(_phase != WaitingAck || event.attempt != _attempt)
+				return;
+			if(_retransmitCount >= (_regs[SetupRetr] & 0x0f))
+			{
+				_status |= MaxRt;
+				if(_lostCount < 15)
+					_lostCount++;
+				_phase = Idle;
+				_stats.failed++;
+				return;
+			}
+			_retransmitCount++;
+			_stats.retransmits++;
+			StartAir(TheMedium().Now());
+		}
+
+		uint8_t _regs[0x20];
+		uint8_t _bank1[0x20][11];
+		uint8_t _rxAddr0[5];
+		uint8_t _rxAddr1[5];
+		uint8_t _txAddr[5];
+		uint8_t _status;
+		bool _bank;
+		bool _featuresActive;
+		bool _ce;
+		bool _selected;
+		uint8_t _command[MaxCommandLength];
+		uint8_t _length;
+
+		std::deque<Frame> _txFifo;
+		std::deque<Frame> _rxFifo;
+		Phase _phase;
+		uint32_t _attempt;
+		AirRecord _air;
+		uint8_t _retransmitCount;
+		uint8_t _lostCount;
+		uint8_t _pid;
+		uint8_t _lastPid[6];
+		uint8_t _lastLength[6];
+		uint8_t _lastData[6][MaxPayload];
+		ChipStats _stats;
+	};
+
+	inline void Medium::Dispatch(const Event &event)
+	{
+		event.chip->OnEvent(event);
+	}
+
+	inline void Medium::Reset()
+	{
+		_events.clear();
+		_air.clear();
+		_now = 0;
+		_lossRate = 0;
+		_latency = 0;
+		_spiByteTime = DefaultSpiByteTime;
+		_pinChangeTime = DefaultPinChangeTime;
+		for(unsigned i = 0; i < ChannelsCount; i++)
+			_noise[i] = 0;
+		memset(&_stats, 0, sizeof(_stats));
+		for(std::vector<Chip*>::iterator i = _chips.begin(); i != _chips.end(); ++i)
+			(*i)->Reset();
+	}
+}
+
+// Spi and pin classes for Rfm70 driver connected to the emulated chip number Id.
+template<int Id>
+struct VirtualRfm70
+{
+	static VirtualRf::Chip &Chip()
+	{
+		static VirtualRf::Chip chip;
+		return chip;
+	}
+
+	struct Spi
+	{
+		static uint8_t ReadWrite(uint8_t value)
+		{
+			uint8_t result = Chip().Transfer(value);
+			Spend(VirtualRf::Medium::Instance().SpiByteTime());
+			return result;
+		}
+	};
+
+	struct SelectPin
+	{
+		static void Set(){Chip().Select(false); PinChange();}
+		static void Clear(){Chip().Select(true); PinChange();}
+		static void SetDirWrite(){}
+		static void SetDirRead(){}
+	};
+
+	struct EnablePin
+	{
+		static void Set(){Chip().SetCe(true); PinChange();}
+		static void Clear(){Chip().SetCe(false); PinChange();}
+		static void SetDirWrite(){}
+		static void SetDirRead(){}
+	};
+
+	// Active low
+	struct IrqPin
+	{
+		static uint8_t IsSet(){return !Chip().IrqAsserted();}
+		static void Set(){}
+		static void Clear(){}
+		static void SetDirWrite(){}
+		static void SetDirRead(){}
+	};
+
+private:
+	static void PinChange()
+	{
+		Spend(VirtualRf::Medium::Instance().PinChangeTime());
+	}
+
+	static void Spend(double us)
+	{
+		if(us > 0)
+			VirtualRf::Medium::Instance().Run(us);
+	}
+};
@@ -0,0 +1,4 @@
+#pragma once
+
+// Host stub of AVR/atomic.h: no interrupts on host
+#define ATOMIC
@@ -0,0 +1,4 @@
+// Host stand-in for avr-libc headers: eeprom is the ordinary memory
+#pragma once
+#include <stdint.h>
+#define eeprom_read_byte(p) (*(const uint8_t*)(p))
@@ -0,0 +1,5 @@
+// Host stand-in for avr-libc headers
+#pragma once
+#define ISR(vector) void vector()
+inline void sei(){}
+inline void cli(){}
@@ -0,0 +1,4 @@
+// Host stand-in for avr-libc headers, lets AVR independent parts of the library build on PC.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
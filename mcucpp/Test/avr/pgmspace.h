@@ -0,0 +1,8 @@
+// Host stand-in for avr-libc headers: flash is the ordinary memory
+#pragma once
+#include <stdint.h>
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
@@ -30,6 +30,9 @@
 #pragma once
 #include <stdlib.h>
 #include <util.h>
+#include <number_format.h>
+#include <number_parser.h>
+#include <fixed_point.h>
 
 template<class DATA_SOURCE, int Base = 10, uint8_t fieldSize=8>
 class TextFormater :public DATA_SOURCE
@@ -39,36 +42,58 @@ public:
 
 	SelfType& operator<< (int value)
 	{
-		char buffer[7];
-		itoa(value, buffer, Base);
-		Puts(buffer);
+		PutInteger<Base>(value);
 		return *this;
 	}
 
 	SelfType& operator<< (long value)
 	{
-		char buffer[11];
-		ltoa(value, buffer, Base);
-		Puts(buffer);
+		PutInteger<Base>(value);
 		return *this;
 	}
 
 	SelfType& operator<< (unsigned long value)
 	{
-		char buffer[11];
-		ultoa(value, buffer, Base);
-		Puts(buffer);
+		PutInteger<Base>(value);
 		return *this;
 	}
 	
 	SelfType& operator<< (unsigned value)
 	{
-		char buffer[7];
-		utoa(value, buffer, Base);
-		Puts(buffer);
+		PutInteger<Base>(value);
+		return *this;
+	}
+
+	template<int FieldBase, class T>
+	SelfType& operator<< (const NumberField<FieldBase, T> &field)
+	{
+		PutInteger<FieldBase>(field.value, field.width, field.flags);
+		return *this;
+	}
+
+	// Fixed point values are printed with 2 decimals, use Fixed<N>() for other precision
+	template<class T, uint8_t FracBits>
+	SelfType& operator<< (FixedPoint<T, FracBits> value)
+	{
+		PutFixed<2>(value);
+		return *this;
+	}
+
+	template<uint8_t Decimals, class T, uint8_t FracBits>
+	SelfType& operator<< (const FixedField<Decimals, T, FracBits> &field)
+	{
+		PutFixed<Decimals>(field.value, field.width, field.flags);
+		return *this;
+	}
+
+	template<uint8_t Decimals, class T>
+	SelfType& operator<< (const ScaledField<Decimals, T> &field)
+	{
+		PutScaled<Decimals>(field.value, field.width, field.flags);
 		return *this;
 	}
 
+	// Pulls in float library, FixedPoint or Scaled() output is much smaller and faster
 	SelfType& operator<< (double value)
 	{
 		const uint8_t presision=2;
@@ -121,6 +146,116 @@ public:
 		}
 	}
 
+	// Integer in the given base, only decimal values get a sign
+	template<int ValueBase, class T>
+	void PutInteger(T value, uint8_t width = 0, uint8_t flags = 0)
+	{
+		typedef typename StaticIf<sizeof(T) <= 2, uint16_t, uint32_t>::Result Unsigned;
+		Unsigned absValue = value;
+		if(ValueBase == 10 && value < 0)
+		{
+			absValue = -absValue;
+			flags |= FormatNegative;
+		}
+		char buffer[NumberFormat<ValueBase>::MaxDigits];
+		char *end = buffer + sizeof(buffer);
+		char *digits = NumberFormat<ValueBase>::Unsigned(absValue, end);
+		PutField(digits, end - digits, width, flags);
+	}
+
+	// Rounded to nearest with integer arithmetic only
+	template<uint8_t Decimals, class T, uint8_t FracBits>
+	void PutFixed(FixedPoint<T, FracBits> value, uint8_t width = 0, uint8_t flags = 0)
+	{
+		// scaled fraction must fit 32 bits
+		BOOST_STATIC_ASSERT((Pow<10, Decimals>::value <= (0xffffffffu >> FracBits)));
+		typedef typename StaticIf<sizeof(T) <= 2, uint16_t, uint32_t>::Result Unsigned;
+		Unsigned absValue = value.Raw();
+		if(value.Raw() < 0)
+		{
+			absValue = -absValue;
+			flags |= FormatNegative;
+		}
+		Unsigned intPart = absValue >> FracBits;
+		uint32_t frac = absValue & ((Unsigned(1) << FracBits) - 1);
+		frac = (frac * Pow<10, Decimals>::value + (1ul << (FracBits - 1))) >> FracBits;
+		if(frac >= Pow<10, Decimals>::value)
+		{
+			frac -= Pow<10, Decimals>::value;
+			intPart++;
+		}
+
+		char buffer[NumberFormat<10>::MaxDigits + 1 + Decimals];
+		char *end = buffer + sizeof(buffer);
+		char *digits = end;
+		if(Decimals)
+		{
+			digits = NumberFormat<10>::Unsigned(frac, end);
+			while(digits > end - Decimals)
+				*--digits = '0';
+			*--digits = '.';
+		}
+		digits = NumberFormat<10>::Unsigned(intPart, digits);
+		PutField(digits, end - digits, width, flags);
+	}
+
+	// value / 10^Decimals
+	template<uint8_t Decimals, class T>
+	void PutScaled(T value, uint8_t width = 0, uint8_t flags = 0)
+	{
+		BOOST_STATIC_ASSERT(Decimals < NumberFormat<10>::MaxDigits);
+		typedef typename StaticIf<sizeof(T) <= 2, uint16_t, uint32_t>::Result Unsigned;
+		Unsigned absValue = value;
+		if(value < 0)
+		{
+			absValue = -absValue;
+			flags |= FormatNegative;
+		}
+
+		char buffer[NumberFormat<10>::MaxDigits + 2];
+		char *end = buffer + sizeof(buffer);
+		char *digits = NumberFormat<10>::Unsigned(absValue, end);
+		if(Decimals)
+		{
+			while(end - digits <= Decimals)
+				*--digits = '0';
+			// move integer digits left to make room for the point
+			char *point = end - Decimals - 1;
+			for(char *p = digits; p <= point; p++)
+				p[-1] = p[0];
+			*point = '.';
+			digits--;
+		}
+		PutField(digits, end - digits, width, flags);
+	}
+
+	void PutField(const char *digits, uint8_t length, uint8_t width, uint8_t flags)
+	{
+		char sign = 0;
+		if(flags & FormatNegative)
+			sign = '-';
+		else if(flags & FormatPlusSign)
+			sign = '+';
+		uint8_t size = sign ? length + 1 : length;
+		uint8_t pad = width > size ? width - size : 0;
+
+		if(!(flags & (FormatLeftAlign | FormatZeroPad)))
+			PutFill(' ', pad);
+		if(sign)
+			DATA_SOURCE::Putch(sign);
+		if((flags & (FormatLeftAlign | FormatZeroPad)) == FormatZeroPad)
+			PutFill('0', pad);
+		Write(digits, length);
+		if(flags & FormatLeftAlign)
+			PutFill(' ', pad);
+	}
+
+	void PutFill(char c, uint8_t count)
+	{
+		for(; count; count--)
+			DATA_SOURCE::Putch(c);
+	}
+
 	void Puts(const char *str)
 	{
 		while(*str)
@@ -174,22 +309,53 @@ public:
 		buffer[pos]=0;
 	} 
 
+	// Numbers are parsed as characters arrive, see NumberParser for syntax.
+	// Value is not changed on error, use ReadNumber() to get the error code.
+	SelfType& operator>> (int &value)
+	{
+		ReadNumber(value);
+		return *this;
+	}
+
 	SelfType& operator>> (unsigned &value)
 	{
-		char buffer[7];
-		Gets(buffer, sizeof(buffer));
-		value = atoi(buffer);
+		ReadNumber(value);
+		return *this;
+	}
+
+	SelfType& operator>> (long &value)
+	{
+		ReadNumber(value);
 		return *this;
 	}
 
 	SelfType& operator>> (unsigned long &value)
 	{
-		char buffer[11];
-		Gets(buffer, sizeof(buffer));
-		value = atol(buffer);
+		ReadNumber(value);
+		return *this;
+	}
+
+	template<class T, uint8_t FracBits>
+	SelfType& operator>> (FixedPoint<T, FracBits> &value)
+	{
+		ReadNumber(value);
 		return *this;
 	}
 
+	// Returns NumberParseError
+	template<class T>
+	uint8_t ReadNumber(T &value)
+	{
+		NumberParser parser(Base);
+		uint8_t c;
+		do
+		{
+			DATA_SOURCE::Getch(c);
+		}
+		while(!parser.Put(c));
+		return parser.Get(value);
+	}
+
 	template<class T>
 	void Write(T value)
 	{
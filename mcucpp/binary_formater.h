@@ -1,8 +1,283 @@
 #pragma once
 
+#include <util.h>
+#include <static_assert.h>
+#include "loki/Typelist.h"
+
+// Serialization of structs field by field with explicit wire format.
+// Layout does not depend on compiler padding, endianness or type sizes:
+//	struct Telemetry
+//	{
+//		uint8_t id;
+//		int16_t temperature;
+//		uint32_t uptime;
+//	};
+//	typedef BinarySchema<
+//		SchemaField<Telemetry, uint8_t, &Telemetry::id>,
+//		SchemaField<Telemetry, int16_t, &Telemetry::temperature, Varint>,
+//		SchemaField<Telemetry, uint32_t, &Telemetry::uptime, BigEndian>
+//		> TelemetrySchema;
+//	interface::WriteFields<TelemetrySchema>(telemetry);
+// Host tools decode the same schema from a buffer with BinaryBufferReader.
+
+template<int Size> struct UnsignedOfSize;
+template<> struct UnsignedOfSize<1>{typedef uint8_t Result;};
+template<> struct UnsignedOfSize<2>{typedef uint16_t Result;};
+template<> struct UnsignedOfSize<4>{typedef uint32_t Result;};
+template<> struct UnsignedOfSize<8>{typedef uint64_t Result;};
+
+// Field encodings.
+// Out has Write(uint8_t), In has uint8_t Read().
+
+struct LittleEndian
+{
+	template<class T>
+	struct MaxSize{enum{value = sizeof(T)};};
+
+	template<class Out, class T>
+	static void Write(Out &out, T value)
+	{
+		typename UnsignedOfSize<sizeof(T)>::Result v = value;
+		for(uint8_t i = 0; i < sizeof(T); i++)
+		{
+			out.Write((uint8_t)v);
+			v >>= 8;
+		}
+	}
+
+	template<class In, class T>
+	static void Read(In &in, T &value)
+	{
+		typedef typename UnsignedOfSize<sizeof(T)>::Result Unsigned;
+		Unsigned v = 0;
+		for(uint8_t i = 0; i < sizeof(T); i++)
+			v |= (Unsigned)in.Read() << (i * 8);
+		value = (T)v;
+	}
+};
+
+struct BigEndian
+{
+	template<class T>
+	struct MaxSize{enum{value = sizeof(T)};};
+
+	template<class Out, class T>
+	static void Write(Out &out, T value)
+	{
+		typename UnsignedOfSize<sizeof(T)>::Result v = value;
+		for(uint8_t i = sizeof(T); i; i--)
+			out.Write((uint8_t)(v >> ((i - 1) * 8)));
+	}
+
+	template<class In, class T>
+	static void Read(In &in, T &value)
+	{
+		typename UnsignedOfSize<sizeof(T)>::Result v = 0;
+		for(uint8_t i = 0; i < sizeof(T); i++)
+			v = (v << 8) | in.Read();
+		value = (T)v;
+	}
+};
+
+// LEB128: 7 bits per byte, low group first, high bit is set in all bytes but the last.
+// Signed values are zigzag encoded, so small negative values are short as well.
+struct Varint
+{
+	template<class T>
+	struct MaxSize{enum{value = (sizeof(T) * 8 + 6) / 7};};
+
+	template<class Out, class T>
+	static void Write(Out &out, T value)
+	{
+		typedef typename UnsignedOfSize<sizeof(T)>::Result Unsigned;
+		Unsigned v = value;
+		if(T(-1) < T(0))
+			v = (v << 1) ^ (value < 0 ? Unsigned(~Unsigned(0)) : 0);
+		while(v >= 0x80)
+		{
+			out.Write((uint8_t)v | 0x80);
+			v >>= 7;
+		}
+		out.Write((uint8_t)v);
+	}
+
+	template<class In, class T>
+	static void Read(In &in, T &value)
+	{
+		typedef typename UnsignedOfSize<sizeof(T)>::Result Unsigned;
+		Unsigned v = 0;
+		uint8_t shift = 0, c;
+		do
+		{
+			c = in.Read();
+			if(shift < sizeof(T) * 8)
+				v |= (Unsigned)(c & 0x7f) << shift;
+			shift += 7;
+		}while((c & 0x80) && shift < MaxSize<T>::value * 7);
+		if(T(-1) < T(0))
+			v = (v >> 1) ^ (v & 1 ? Unsigned(~Unsigned(0)) : 0);
+		value = (T)v;
+	}
+};
+
+// Member of Struct with its encoding
+template<class Struct, class T, T Struct::*Member, class Encoding = LittleEndian>
+struct SchemaField
+{
+	enum{MaxSize = Encoding::template MaxSize<T>::value};
+
+	template<class Out>
+	static void Write(Out &out, const Struct &value)
+	{
+		Encoding::Write(out, value.*Member);
+	}
+
+	template<class In>
+	static void Read(In &in, Struct &value)
+	{
+		Encoding::Read(in, value.*Member);
+	}
+};
+
+template<class Fields> struct SchemaFields;
+
+template<> struct SchemaFields<Loki::NullType>
+{
+	enum{MaxSize = 0};
+
+	template<class Out, class Struct>
+	static void Write(Out &, const Struct &)
+	{}
+
+	template<class In, class Struct>
+	static void Read(In &, Struct &)
+	{}
+};
+
+template<class Head, class Tail> struct SchemaFields<Loki::Typelist<Head, Tail> >
+{
+	enum{MaxSize = Head::MaxSize + SchemaFields<Tail>::MaxSize};
+
+	template<class Out, class Struct>
+	static void Write(Out &out, const Struct &value)
+	{
+		Head::Write(out, value);
+		SchemaFields<Tail>::Write(out, value);
+	}
+
+	template<class In, class Struct>
+	static void Read(In &in, Struct &value)
+	{
+		Head::Read(in, value);
+		SchemaFields<Tail>::Read(in, value);
+	}
+};
+
+// List of up to 12 SchemaField, written in the listed order.
+// MaxSize is the longest encoded size, for buffers.
+template<class F1 = Loki::NullType, class F2 = Loki::NullType, class F3 = Loki::NullType,
+		class F4 = Loki::NullType, class F5 = Loki::NullType, class F6 = Loki::NullType,
+		class F7 = Loki::NullType, class F8 = Loki::NullType, class F9 = Loki::NullType,
+		class F10 = Loki::NullType, class F11 = Loki::NullType, class F12 = Loki::NullType>
+class BinarySchema
+{
+	typedef typename Loki::TL::MakeTypelist<F1, F2, F3, F4, F5, F6, F7, F8, F9, F10, F11, F12>::Result Fields;
+public:
+	enum{MaxSize = SchemaFields<Fields>::MaxSize};
+
+	template<class Out, class Struct>
+	static void Write(Out &out, const Struct &value)
+	{
+		SchemaFields<Fields>::Write(out, value);
+	}
+
+	template<class In, class Struct>
+	static void Read(In &in, Struct &value)
+	{
+		SchemaFields<Fields>::Read(in, value);
+	}
+};
+
+// Encodes to a memory buffer, extra bytes are dropped and counted as overrun
+class BinaryBufferWriter
+{
+public:
+	BinaryBufferWriter(uint8_t *buffer, size_t size)
+		:_pos(buffer), _begin(buffer), _end(buffer + size), _overrun(false)
+	{}
+
+	void Write(uint8_t c)
+	{
+		if(_pos < _end)
+			*_pos++ = c;
+		else
+			_overrun = true;
+	}
+
+	size_t Size()const
+	{
+		return _pos - _begin;
+	}
+
+	bool Overrun()const
+	{
+		return _overrun;
+	}
+
+private:
+	uint8_t *_pos;
+	uint8_t *_begin;
+	uint8_t *_end;
+	bool _overrun;
+};
+
+// Decodes from a memory buffer, e.g. in host tools. Reads past the end return 0 and set Overrun().
+class BinaryBufferReader
+{
+public:
+	BinaryBufferReader(const uint8_t *buffer, size_t size)
+		:_pos(buffer), _begin(buffer), _end(buffer + size), _overrun(false)
+	{}
+
+	uint8_t Read()
+	{
+		if(_pos < _end)
+			return *_pos++;
+		_overrun = true;
+		return 0;
+	}
+
+	size_t Position()const
+	{
+		return _pos - _begin;
+	}
+
+	bool Overrun()const
+	{
+		return _overrun;
+	}
+
+private:
+	const uint8_t *_pos;
+	const uint8_t *_begin;
+	const uint8_t *_end;
+	bool _overrun;
+};
+
 template<class DATA_SOURCE>
 class BinaryFormater :public DATA_SOURCE
 {
+	struct ByteStream
+	{
+		void Write(uint8_t c)
+		{
+			DATA_SOURCE::Write(c);
+		}
+		uint8_t Read()
+		{
+			return DATA_SOURCE::Read();
+		}
+	};
 public:
 	using DATA_SOURCE::Write;
 	using DATA_SOURCE::Read;
@@ -11,10 +286,10 @@ public:
 	{
 		Int32 i;
 		i.Dword = value;
-		DATA_SOURCE::Putch(i.Bytes[0]);
-		DATA_SOURCE::Putch(i.Bytes[1]);
-		DATA_SOURCE::Putch(i.Bytes[2]);
-		DATA_SOURCE::Putch(i.Bytes[3]);
+		DATA_SOURCE::Write(i.Bytes[0]);
+		DATA_SOURCE::Write(i.Bytes[1]);
+		DATA_SOURCE::Write(i.Bytes[2]);
+		DATA_SOURCE::Write(i.Bytes[3]);
 	}
 
 	static void Write(uint16_t value)
@@ -77,4 +352,19 @@ public:
 		i.Bytes[1] = DATA_SOURCE::Read();
 		return i.Word;
 	}
+
+	// Writes value field by field as described by BinarySchema
+	template<class Schema, class T>
+	static void WriteFields(const T &value)
+	{
+		ByteStream stream;
+		Schema::Write(stream, value);
+	}
+
+	template<class Schema, class T>
+	static void ReadFields(T &value)
+	{
+		ByteStream stream;
+		Schema::Read(stream, value);
+	}
 };
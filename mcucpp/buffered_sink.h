@@ -0,0 +1,110 @@
+#pragma once
+
+#include <util.h>
+
+// Detects block write API of a data sink:
+//	static void Write(const void *data, uint8_t size);
+template<class Sink>
+class HasBlockWrite
+{
+	typedef char Yes;
+	typedef struct{char c[2];} No;
+	template<class T, void (*)(const void *, uint8_t)> struct Check;
+	template<class T> static Yes Test(Check<T, &T::Write> *);
+	template<class T> static No Test(...);
+public:
+	enum{value = sizeof(Test<Sink>(0)) == sizeof(Yes)};
+};
+
+template<class Sink, bool BlockWrite = HasBlockWrite<Sink>::value>
+struct SinkWriter
+{
+	static void Write(const uint8_t *data, uint8_t size)
+	{
+		Sink::Write(data, size);
+	}
+};
+
+template<class Sink>
+struct SinkWriter<Sink, false>
+{
+	static void Write(const uint8_t *data, uint8_t size)
+	{
+		for(; size; size--)
+			Sink::Putch(*data++);
+	}
+};
+
+// Data source adapter for TextFormater, collects output in a static buffer
+// and passes it to the sink with one block write instead of a Putch call per character.
+// Sinks without block write get the buffer with Putch in a tight loop.
+// The buffer is flushed when it is full, on '\n' if FlushOnNewLine is set and by Flush().
+//	typedef TextFormater<BufferedSink<Lcd, 20> > Out;
+//	Out out;
+//	Statement(out) << "T=" << t << " C";	// one write per statement
+template<class Sink, uint8_t Size = 32, bool FlushOnNewLine = true>
+class BufferedSink :public Sink
+{
+	BOOST_STATIC_ASSERT(Size > 0);
+public:
+	static void Putch(uint8_t c)
+	{
+		_buffer[_count++] = c;
+		if(_count == Size || (FlushOnNewLine && c == '\n'))
+			Flush();
+	}
+
+	static void Flush()
+	{
+		if(_count)
+		{
+			SinkWriter<Sink>::Write(_buffer, _count);
+			_count = 0;
+		}
+	}
+
+	static uint8_t Buffered()
+	{
+		return _count;
+	}
+
+private:
+	static uint8_t _buffer[Size];
+	static uint8_t _count;
+};
+
+template<class Sink, uint8_t Size, bool FlushOnNewLine>
+	uint8_t BufferedSink<Sink, Size, FlushOnNewLine>::_buffer[Size];
+
+template<class Sink, uint8_t Size, bool FlushOnNewLine>
+	uint8_t BufferedSink<Sink, Size, FlushOnNewLine>::_count;
+
+// Flushes the formater at the end of the statement it is used in.
+template<class Formater>
+class FormatStatement
+{
+public:
+	FormatStatement(Formater &out)
+		:_out(out)
+	{}
+
+	~FormatStatement()
+	{
+		_out.Flush();
+	}
+
+	template<class T>
+	Formater& operator<< (const T &value)
+	{
+		return _out << value;
+	}
+
+private:
+	Formater &_out;
+};
+
+template<class Formater>
+FormatStatement<Formater> Statement(Formater &out)
+{
+	return FormatStatement<Formater>(out);
+}
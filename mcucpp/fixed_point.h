@@ -0,0 +1,148 @@
+#pragma once
+
+#include <util.h>
+#include <static_assert.h>
+
+// Binary fixed point number: T is the storage type, FracBits is number of fractional bits,
+// e.g. FixedPoint<int32_t, 16> is Q16.16 and FixedPoint<int16_t, 8> is Q8.8.
+// Only integer arithmetic is used.
+template<class T, uint8_t FracBits>
+class FixedPoint
+{
+	BOOST_STATIC_ASSERT(FracBits > 0 && FracBits < sizeof(T) * 8);
+	// product of two values before scaling back
+	typedef typename StaticIf<sizeof(T) <= 2, int32_t, int64_t>::Result WideType;
+public:
+	typedef T RawType;
+	enum{FractionalBits = FracBits};
+
+	FixedPoint()
+		:_raw(0)
+	{}
+
+	static FixedPoint FromRaw(T raw)
+	{
+		FixedPoint result;
+		result._raw = raw;
+		return result;
+	}
+
+	static FixedPoint FromInt(T value)
+	{
+		return FromRaw(value * (T(1) << FracBits));
+	}
+
+	// num / den, is folded at compile time for constant arguments
+	static FixedPoint FromRatio(int32_t num, int32_t den)
+	{
+		return FromRaw((T)(((WideType)num << FracBits) / den));
+	}
+
+	T Raw()const
+	{
+		return _raw;
+	}
+
+	// Rounded towards minus infinity
+	T IntegerPart()const
+	{
+		return _raw >> FracBits;
+	}
+
+	FixedPoint& operator+=(FixedPoint other)
+	{
+		_raw += other._raw;
+		return *this;
+	}
+
+	FixedPoint& operator-=(FixedPoint other)
+	{
+		_raw -= other._raw;
+		return *this;
+	}
+
+	FixedPoint& operator*=(FixedPoint other)
+	{
+		_raw = (T)(((WideType)_raw * other._raw) >> FracBits);
+		return *this;
+	}
+
+	FixedPoint& operator*=(T value)
+	{
+		_raw *= value;
+		return *this;
+	}
+
+	FixedPoint operator+(FixedPoint other)const
+	{
+		return FixedPoint(*this) += other;
+	}
+
+	FixedPoint operator-(FixedPoint other)const
+	{
+		return FixedPoint(*this) -= other;
+	}
+
+	FixedPoint operator*(FixedPoint other)const
+	{
+		return FixedPoint(*this) *= other;
+	}
+
+	FixedPoint operator*(T value)const
+	{
+		return FixedPoint(*this) *= value;
+	}
+
+	FixedPoint operator-()const
+	{
+		return FromRaw(-_raw);
+	}
+
+	bool operator==(FixedPoint other)const{return _raw == other._raw;}
+	bool operator!=(FixedPoint other)const{return _raw != other._raw;}
+	bool operator<(FixedPoint other)const{return _raw < other._raw;}
+	bool operator>(FixedPoint other)const{return _raw > other._raw;}
+	bool operator<=(FixedPoint other)const{return _raw <= other._raw;}
+	bool operator>=(FixedPoint other)const{return _raw >= other._raw;}
+
+private:
+	T _raw;
+};
+
+// Fixed point value printed with Decimals digits after the point, rounded to nearest:
+//	out << Fixed<3>(voltage, 8);
+template<uint8_t Decimals, class T, uint8_t FracBits>
+struct FixedField
+{
+	FixedField(FixedPoint<T, FracBits> v, uint8_t w, uint8_t f)
+		:value(v), width(w), flags(f)
+	{}
+	FixedPoint<T, FracBits> value;
+	uint8_t width;
+	uint8_t flags;
+};
+
+template<uint8_t Decimals, class T, uint8_t FracBits>
+FixedField<Decimals, T, FracBits> Fixed(FixedPoint<T, FracBits> value, uint8_t width = 0, uint8_t flags = 0)
+{
+	return FixedField<Decimals, T, FracBits>(value, width, flags);
+}
+
+// Integer scaled by 10^Decimals, e.g. millivolts printed as volts:
+//	out << Scaled<3>(millivolts);
+template<uint8_t Decimals, class T>
+struct ScaledField
+{
+	ScaledField(T v, uint8_t w, uint8_t f)
+		:value(v), width(w), flags(f)
+	{}
+	T value;
+	uint8_t width;
+	uint8_t flags;
+};
+
+template<uint8_t Decimals, class T>
+ScaledField<Decimals, T> Scaled(T value, uint8_t width = 0, uint8_t flags = 0)
+{
+	return ScaledField<Decimals, T>(value, width, flags);
+}
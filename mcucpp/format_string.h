@@ -0,0 +1,284 @@
+#pragma once
+
+#include "loki/Typelist.h"
+#include <static_assert.h>
+#include <number_format.h>
+#include <fixed_point.h>
+
+// Type safe formatted output for TextFormater without runtime format parsing.
+// A format is a type: list of flash literals and typed argument fields.
+// Argument count and types are checked at compile time and Write() expands
+// to straight-line calls of the TextFormater writers. Literals are printed with PutsP.
+//	FORMAT_STRING(TempLabel, "T=");
+//	FORMAT_STRING(IdLabel, " C, id=");
+//	typedef Format<FmtStr<TempLabel>, FmtFixed<1>, FmtStr<IdLabel>, FmtHex<4, FormatZeroPad>, FmtChar> TempFormat;
+//	TempFormat::Write(out, temperature, id, '\n');
+// Up to 8 items with up to 6 arguments.
+
+// Defines a flash literal for FmtStr. It is a template argument, so it must have external linkage:
+// define it once in a .cpp file, not in a header.
+#define FORMAT_STRING(name, text) extern const char name[] PROGMEM; const char name[] PROGMEM = text
+
+template<class T> struct IsInteger{enum{value = 0};};
+template<> struct IsInteger<char>{enum{value = 1};};
+template<> struct IsInteger<signed char>{enum{value = 1};};
+template<> struct IsInteger<unsigned char>{enum{value = 1};};
+template<> struct IsInteger<short>{enum{value = 1};};
+template<> struct IsInteger<unsigned short>{enum{value = 1};};
+template<> struct IsInteger<int>{enum{value = 1};};
+template<> struct IsInteger<unsigned>{enum{value = 1};};
+template<> struct IsInteger<long>{enum{value = 1};};
+template<> struct IsInteger<unsigned long>{enum{value = 1};};
+
+struct FormatNoArg{};
+
+// Arguments of one Write() call
+template<class A1 = FormatNoArg, class A2 = FormatNoArg, class A3 = FormatNoArg,
+		class A4 = FormatNoArg, class A5 = FormatNoArg, class A6 = FormatNoArg>
+struct FormatArgs
+{
+	typedef A1 Type1; typedef A2 Type2; typedef A3 Type3;
+	typedef A4 Type4; typedef A5 Type5; typedef A6 Type6;
+	A1 a1; A2 a2; A3 a3; A4 a4; A5 a5; A6 a6;
+};
+
+template<int Index, class Args> struct FormatArg;
+
+template<class Args> struct FormatArg<0, Args>
+{
+	typedef typename Args::Type1 Type;
+	static Type Get(const Args &args){return args.a1;}
+};
+
+template<class Args> struct FormatArg<1, Args>
+{
+	typedef typename Args::Type2 Type;
+	static Type Get(const Args &args){return args.a2;}
+};
+
+template<class Args> struct FormatArg<2, Args>
+{
+	typedef typename Args::Type3 Type;
+	static Type Get(const Args &args){return args.a3;}
+};
+
+template<class Args> struct FormatArg<3, Args>
+{
+	typedef typename Args::Type4 Type;
+	static Type Get(const Args &args){return args.a4;}
+};
+
+template<class Args> struct FormatArg<4, Args>
+{
+	typedef typename Args::Type5 Type;
+	static Type Get(const Args &args){return args.a5;}
+};
+
+template<class Args> struct FormatArg<5, Args>
+{
+	typedef typename Args::Type6 Type;
+	static Type Get(const Args &args){return args.a6;}
+};
+
+// Format items.
+// Write<Index>() prints the item, Index is the number of arguments consumed by the previous items.
+
+// Flash literal defined with FORMAT_STRING
+template<const char *Str>
+struct FmtStr
+{
+	enum{IsArgument = 0};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &)
+	{
+		out.PutsP(Str);
+	}
+};
+
+// Decimal integer
+template<uint8_t Width = 0, uint8_t Flags = 0>
+struct FmtDec
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		typedef FormatArg<Index, Args> Arg;
+		BOOST_STATIC_ASSERT(IsInteger<typename Arg::Type>::value);
+		out.template PutInteger<10>(Arg::Get(args), Width, Flags);
+	}
+};
+
+// Hexadecimal integer
+template<uint8_t Width = 0, uint8_t Flags = 0>
+struct FmtHex
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		typedef FormatArg<Index, Args> Arg;
+		BOOST_STATIC_ASSERT(IsInteger<typename Arg::Type>::value);
+		out.template PutInteger<16>(Arg::Get(args), Width, Flags);
+	}
+};
+
+// FixedPoint value with Decimals digits after the point
+template<uint8_t Decimals = 2, uint8_t Width = 0, uint8_t Flags = 0>
+struct FmtFixed
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		// argument must be a FixedPoint
+		out.template PutFixed<Decimals>(FormatArg<Index, Args>::Get(args), Width, Flags);
+	}
+};
+
+// Integer scaled by 10^Decimals
+template<uint8_t Decimals, uint8_t Width = 0, uint8_t Flags = 0>
+struct FmtScaled
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		typedef FormatArg<Index, Args> Arg;
+		BOOST_STATIC_ASSERT(IsInteger<typename Arg::Type>::value);
+		out.template PutScaled<Decimals>(Arg::Get(args), Width, Flags);
+	}
+};
+
+// String in RAM
+struct FmtText
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		const char *str = FormatArg<Index, Args>::Get(args);
+		out.Puts(str);
+	}
+};
+
+// String in flash
+struct FmtTextP
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		const char *str = FormatArg<Index, Args>::Get(args);
+		out.PutsP(str);
+	}
+};
+
+struct FmtChar
+{
+	enum{IsArgument = 1};
+	template<int Index, class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		typedef FormatArg<Index, Args> Arg;
+		BOOST_STATIC_ASSERT(IsInteger<typename Arg::Type>::value);
+		out.Putch(Arg::Get(args));
+	}
+};
+
+template<class Items> struct FormatArgsCount;
+
+template<> struct FormatArgsCount<Loki::NullType>
+{
+	enum{value = 0};
+};
+
+template<class Head, class Tail> struct FormatArgsCount<Loki::Typelist<Head, Tail> >
+{
+	enum{value = Head::IsArgument + FormatArgsCount<Tail>::value};
+};
+
+template<class Items, int Index> struct FormatItems;
+
+template<int Index> struct FormatItems<Loki::NullType, Index>
+{
+	template<class Out, class Args>
+	static void Write(Out &, const Args &)
+	{}
+};
+
+template<class Head, class Tail, int Index> struct FormatItems<Loki::Typelist<Head, Tail>, Index>
+{
+	template<class Out, class Args>
+	static void Write(Out &out, const Args &args)
+	{
+		Head::template Write<Index>(out, args);
+		FormatItems<Tail, Index + Head::IsArgument>::Write(out, args);
+	}
+};
+
+template<class I1 = Loki::NullType, class I2 = Loki::NullType, class I3 = Loki::NullType, class I4 = Loki::NullType,
+		class I5 = Loki::NullType, class I6 = Loki::NullType, class I7 = Loki::NullType, class I8 = Loki::NullType>
+class Format
+{
+	typedef typename Loki::TL::MakeTypelist<I1, I2, I3, I4, I5, I6, I7, I8>::Result Items;
+	typedef FormatItems<Items, 0> Writer;
+public:
+	enum{ArgumentsCount = FormatArgsCount<Items>::value};
+
+	template<class Out>
+	static void Write(Out &out)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 0);
+		FormatArgs<> args = {};
+		Writer::Write(out, args);
+	}
+
+	template<class Out, class A1>
+	static void Write(Out &out, A1 a1)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 1);
+		FormatArgs<A1> args = {a1};
+		Writer::Write(out, args);
+	}
+
+	template<class Out, class A1, class A2>
+	static void Write(Out &out, A1 a1, A2 a2)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 2);
+		FormatArgs<A1, A2> args = {a1, a2};
+		Writer::Write(out, args);
+	}
+
+	template<class Out, class A1, class A2, class A3>
+	static void Write(Out &out, A1 a1, A2 a2, A3 a3)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 3);
+		FormatArgs<A1, A2, A3> args = {a1, a2, a3};
+		Writer::Write(out, args);
+	}
+
+	template<class Out, class A1, class A2, class A3, class A4>
+	static void Write(Out &out, A1 a1, A2 a2, A3 a3, A4 a4)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 4);
+		FormatArgs<A1, A2, A3, A4> args = {a1, a2, a3, a4};
+		Writer::Write(out, args);
+	}
+
+	template<class Out, class A1, class A2, class A3, class A4, class A5>
+	static void Write(Out &out, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 5);
+		FormatArgs<A1, A2, A3, A4, A5> args = {a1, a2, a3, a4, a5};
+		Writer::Write(out, args);
+	}
+
+	template<class Out, class A1, class A2, class A3, class A4, class A5, class A6>
+	static void Write(Out &out, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6)
+	{
+		BOOST_STATIC_ASSERT(ArgumentsCount == 6);
+		FormatArgs<A1, A2, A3, A4, A5, A6> args = {a1, a2, a3, a4, a5, a6};
+		Writer::Write(out, args);
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <util.h>
+
+// Integer to text conversion without division.
+// Decimal digits are produced two at a time: value is divided by 100 (or 10000 for 32 bit values)
+// with reciprocal multiplication and the remainder is looked up in a digit pairs table in flash.
+
+enum NumberFormatFlags
+{
+	FormatLeftAlign	= 1,	// pad with spaces on the right
+	FormatZeroPad	= 2,	// pad with zeros between sign and digits
+	FormatPlusSign	= 4,	// print '+' for non negative decimal values
+	FormatNegative	= 0x80	// set by formater for negative values
+};
+
+// "00", "01", ... "99"
+inline const char *DigitPairs()
+{
+	static const char pairs[] PROGMEM =
+		"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+		"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+	return pairs;
+}
+
+template<int Base>
+class NumberFormat
+{
+public:
+	// Max number of digits of 32 bit value
+	enum{MaxDigits = Base >= 10 ? 10 : Base >= 8 ? 11 : Base >= 4 ? 16 : 32};
+
+	// Places digits of value right before the end, returns pointer to the first digit.
+	// Base is a constant, so division is replaced with shifts for power of 2 bases.
+	template<class T>
+	static char *Unsigned(T value, char *end)
+	{
+		do
+		{
+			uint8_t digit = value % Base;
+			value /= Base;
+			*--end = digit < 10 ? '0' + digit : 'a' - 10 + digit;
+		}while(value);
+		return end;
+	}
+};
+
+template<>
+class NumberFormat<10>
+{
+	static char *PutPair(uint8_t value, char *end)
+	{
+		const char *pair = DigitPairs() + value * 2;
+		*--end = pgm_read_byte(pair + 1);
+		*--end = pgm_read_byte(pair);
+		return end;
+	}
+
+public:
+	enum{MaxDigits = 10};
+
+	static char *Unsigned(uint16_t value, char *end)
+	{
+		uint16_t rem;
+		while(value >= 100)
+		{
+			value = div100(value, rem);
+			end = PutPair(rem, end);
+		}
+		if(value >= 10)
+			return PutPair(value, end);
+		*--end = '0' + value;
+		return end;
+	}
+
+	static char *Unsigned(uint32_t value, char *end)
+	{
+		// split to 4 digit groups, so that the rest is done in 16 bits
+		while(value > 0xffff)
+		{
+			uint32_t rem;
+			uint16_t low, high;
+			value = div10000(value, rem);
+			high = div100((uint16_t)rem, low);
+			end = PutPair(low, end);
+			end = PutPair(high, end);
+		}
+		return Unsigned((uint16_t)value, end);
+	}
+};
+
+// Integer with field width and format flags, e.g.: out << Dec(value, 5, FormatZeroPad);
+template<int Base, class T>
+struct NumberField
+{
+	NumberField(T v, uint8_t w, uint8_t f)
+		:value(v), width(w), flags(f)
+	{}
+	T value;
+	uint8_t width;
+	uint8_t flags;
+};
+
+template<class T>
+NumberField<10, T> Dec(T value, uint8_t width = 0, uint8_t flags = 0)
+{
+	return NumberField<10, T>(value, width, flags);
+}
+
+template<class T>
+NumberField<16, T> Hex(T value, uint8_t width = 0, uint8_t flags = 0)
+{
+	return NumberField<16, T>(value, width, flags);
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <util.h>
+#include <fixed_point.h>
+#include <static_assert.h>
+
+// Incremental text to number conversion.
+// Characters are passed one by one as they arrive, no line buffer is needed:
+//	NumberParser parser;
+//	while(!parser.Put(GetNextChar()));
+//	int value;
+//	if(parser.Get(value) == ParseOk) ...
+// Syntax: [spaces] [+|-] [0x] digits [. digits] terminator
+// Leading spaces and control characters are skipped. The number ends with a space,
+// control character, ',' or ';'. The terminator is consumed and can be read with Terminator().
+// "0x" prefix selects base 16 in any base. Fraction is accepted in base 10 only,
+// digits after MaxFractionDigits are ignored.
+// On error the rest of the token is consumed up to the terminator, so the next
+// number is parsed from a clean position.
+
+enum NumberParseError
+{
+	ParseOk = 0,
+	ParseNoDigits,		// empty token or sign only
+	ParseInvalidChar,	// non digit character in the token
+	ParseOverflow,		// value does not fit 32 bits or the target type
+	ParseFraction		// fraction for an integer target
+};
+
+class NumberParser
+{
+	enum State
+	{
+		StateStart,
+		StateSign,
+		StateZero,
+		StateInteger,
+		StateFraction,
+		StateSkip,
+		StateDone
+	};
+public:
+	enum{MaxFractionDigits = 4};
+
+	NumberParser(uint8_t base = 10)
+	{
+		Reset(base);
+	}
+
+	void Reset(uint8_t base = 10)
+	{
+		_value = 0;
+		_fraction = 0;
+		_fractionDigits = 0;
+		_digits = 0;
+		_negative = false;
+		_error = ParseOk;
+		_terminator = 0;
+		_state = StateStart;
+		SetBase(base);
+	}
+
+	// Returns true when the number is complete (terminator is consumed), check Error() then
+	bool Put(char c)
+	{
+		if(_state == StateDone)
+			return true;
+		if(IsTerminator(c))
+		{
+			if(_state == StateStart)
+				return false;
+			_terminator = c;
+			if(_error == ParseOk && _digits == 0)
+				_error = ParseNoDigits;
+			_state = StateDone;
+			return true;
+		}
+
+		switch(_state)
+		{
+		case StateStart:
+			if(c == '-' || c == '+')
+			{
+				_negative = c == '-';
+				_state = StateSign;
+				return false;
+			}
+			// fall through
+		case StateSign:
+			if(c == '0')
+			{
+				_digits++;
+				_state = StateZero;
+				return false;
+			}
+			// fall through
+		case StateZero:
+			if(_state == StateZero && (c == 'x' || c == 'X') && _base != 16)
+			{
+				_digits = 0;
+				SetBase(16);
+				_state = StateInteger;
+				return false;
+			}
+			// fall through
+		case StateInteger:
+			_state = StateInteger;
+			if(c == '.' && _base == 10)
+			{
+				_state = StateFraction;
+				return false;
+			}
+			PutDigit(c);
+			break;
+		case StateFraction:
+			PutFractionDigit(c);
+			break;
+		default:
+			break;
+		}
+		return false;
+	}
+
+	bool Done()const
+	{
+		return _state == StateDone;
+	}
+
+	uint8_t Error()const
+	{
+		return _error;
+	}
+
+	char Terminator()const
+	{
+		return _terminator;
+	}
+
+	bool Negative()const
+	{
+		return _negative;
+	}
+
+	// Integer part of absolute value
+	uint32_t Magnitude()const
+	{
+		return _value;
+	}
+
+	// Fraction digits as integer, e.g. 25 for "1.25"
+	uint16_t Fraction()const
+	{
+		return _fraction;
+	}
+
+	uint8_t FractionDigits()const
+	{
+		return _fractionDigits;
+	}
+
+	// Stores the result in value, value is not changed on error.
+	// Hex values may fill unsigned range of signed types: 0xffff is -1 for int16_t.
+	template<class T>
+	uint8_t Get(T &value)const
+	{
+		if(_error != ParseOk)
+			return _error;
+		if(_fractionDigits != 0)
+			return ParseFraction;
+		const bool isSigned = T(-1) < T(0);
+		uint32_t max = sizeof(T) >= 4 ? 0xfffffffful : (1ul << (sizeof(T) * 8)) - 1;
+		if(isSigned && (_negative || _base == 10))
+			max >>= 1;
+		if(_negative)
+		{
+			if(isSigned)
+				max++;
+			else if(_value != 0)
+				return ParseOverflow;
+		}
+		if(_value > max)
+			return ParseOverflow;
+		if(_negative && _value != 0)
+			value = -T(_value - 1) - 1;
+		else
+			value = T(_value);
+		return ParseOk;
+	}
+
+	// Decimal fraction is rounded to nearest FracBits value
+	template<class T, uint8_t FracBits>
+	uint8_t Get(FixedPoint<T, FracBits> &value)const
+	{
+		// scaled fraction must fit 32 bits
+		BOOST_STATIC_ASSERT(FracBits <= 18);
+		if(_error != ParseOk)
+			return _error;
+		typedef typename StaticIf<sizeof(T) <= 2, uint16_t, uint32_t>::Result Unsigned;
+		const Unsigned maxRaw = (Unsigned(~Unsigned(0)) >> 1) + (_negative ? 1 : 0);
+		if(_value > (maxRaw >> FracBits))
+			return ParseOverflow;
+		static const uint16_t scale[MaxFractionDigits + 1] = {1, 10, 100, 1000, 10000};
+		uint16_t div = scale[_fractionDigits];
+		uint32_t frac = (((uint32_t)_fraction << FracBits) + div / 2) / div;
+		Unsigned raw = ((Unsigned)_value << FracBits) + (Unsigned)frac;
+		if(raw > maxRaw)
+			return ParseOverflow;
+		value = FixedPoint<T, FracBits>::FromRaw(T(_negative ? Unsigned(-raw) : raw));
+		return ParseOk;
+	}
+
+protected:
+	static bool IsTerminator(char c)
+	{
+		return (uint8_t)c <= ' ' || c == ',' || c == ';';
+	}
+
+	void SetBase(uint8_t base)
+	{
+		_base = base;
+		// once per number, digits are checked against it without division
+		_limit = 0xfffffffful / base;
+		_lastDigitLimit = (uint8_t)(0xfffffffful - _limit * base);
+	}
+
+	// Digit value or 0xff
+	static uint8_t DigitValue(char c)
+	{
+		if(c >= '0' && c <= '9')
+			return c - '0';
+		c |= 0x20;
+		if(c >= 'a' && c <= 'z')
+			return c - 'a' + 10;
+		return 0xff;
+	}
+
+	void PutDigit(char c)
+	{
+		uint8_t digit = DigitValue(c);
+		if(digit >= _base)
+		{
+			SetError(ParseInvalidChar);
+			return;
+		}
+		if(_value > _limit || (_value == _limit && digit > _lastDigitLimit))
+		{
+			SetError(ParseOverflow);
+			return;
+		}
+		_value = _value * _base + digit;
+		_digits++;
+	}
+
+	void PutFractionDigit(char c)
+	{
+		uint8_t digit = DigitValue(c);
+		if(digit >= 10)
+		{
+			SetError(ParseInvalidChar);
+			return;
+		}
+		_digits++;
+		if(_fractionDigits < MaxFractionDigits)
+		{
+			_fraction = _fraction * 10 + digit;
+			_fractionDigits++;
+		}
+	}
+
+	void SetError(uint8_t error)
+	{
+		_error = error;
+		_state = StateSkip;
+	}
+
+	uint32_t _value;
+	uint32_t _limit;
+	uint16_t _fraction;
+	uint8_t _fractionDigits;
+	uint8_t _digits;
+	uint8_t _base;
+	uint8_t _lastDigitLimit;
+	uint8_t _state;
+	uint8_t _error;
+	char _terminator;
+	bool _negative;
+};
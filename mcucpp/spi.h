@@ -1,27 +1,93 @@
-
 #include <iopins.h>
 #include <pinlist.h>
 
-template<class Mosi, class Miso, class Clock>
+enum SpiBitOrder
+{
+	SpiMsbFirst,
+	SpiLsbFirst
+};
+
+// Bit banged SPI master.
+// ClockPolarity - clock idle level (CPOL), ClockPhase - data are sampled on
+// the leading (false) or on the trailing (true) clock edge (CPHA).
+// Init() must be called once before any transfer.
+template<class Mosi, class Miso, class Clock, 
+		bool ClockPolarity = false, 
+		bool ClockPhase = false, 
+		SpiBitOrder BitOrder = SpiMsbFirst>
 class SoftSpi
 {
-	typedef IO::PinList<Mosi, Miso, Clock> OutPins;
+	typedef IO::PinList<Mosi, Clock> OutPins;
+
+	static void ClockLeadingEdge()
+	{
+		Clock::Set(!ClockPolarity);
+	}
+
+	static void ClockTrailingEdge()
+	{
+		Clock::Set(ClockPolarity);
+	}
+
+	template<uint8_t bit>
+	static void TransferBit(uint8_t out, uint8_t &in)
+	{
+		enum{Mask = BitOrder == SpiLsbFirst ? (1 << bit) : (0x80 >> bit)};
+		if(ClockPhase)
+		{
+			ClockLeadingEdge();
+			Mosi::Set(out & Mask);
+			ClockTrailingEdge();
+			if(Miso::IsSet())
+				in |= Mask;
+		}
+		else
+		{
+			Mosi::Set(out & Mask);
+			ClockLeadingEdge();
+			if(Miso::IsSet())
+				in |= Mask;
+			ClockTrailingEdge();
+		}
+	}
 	
 	public:
-	static uint8_t ReadWrite(uint8_t value)
+	static void Init()
 	{
 		OutPins::SetConfiguration(OutPins::Out, 0xff);
 		Miso::SetConfiguration(Miso::Port::In);
-		
-		for(uint8_t i = 0; i < 8;i++)
-		{
-			Mosi::Set(value & 0x80);
-			Clock::Set();
-			value <<= 1;
-			if(Miso::IsSet())
-				value |= 1;
-			Clock::Clear();
-		}
-		return value;
+		Clock::Set(ClockPolarity);
+	}
+
+	static uint8_t ReadWrite(uint8_t value)
+	{
+		uint8_t result = 0;
+		TransferBit<0>(value, result);
+		TransferBit<1>(value, result);
+		TransferBit<2>(value, result);
+		TransferBit<3>(value, result);
+		TransferBit<4>(value, result);
+		TransferBit<5>(value, result);
+		TransferBit<6>(value, result);
+		TransferBit<7>(value, result);
+		return result;
+	}
+
+	static void Transfer(const uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size)
+	{
+		for(const uint8_t *end = txBuffer + size; txBuffer != end; ++txBuffer, ++rxBuffer)
+			*rxBuffer = ReadWrite(*txBuffer);
+	}
+
+	static void Write(const uint8_t *buffer, uint16_t size)
+	{
+		for(const uint8_t *end = buffer + size; buffer != end; ++buffer)
+			ReadWrite(*buffer);
+	}
+
+	static void Read(uint8_t *buffer, uint16_t size, uint8_t dummy = 0)
+	{
+		for(uint8_t *end = buffer + size; buffer != end; ++buffer)
+			*buffer = ReadWrite(dummy);
 	}
 };
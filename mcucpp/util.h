@@ -159,30 +159,53 @@ inline uint8_t ilog10 (T x)
     return i;
 }
 
+// division by constants with reciprocal multiplication, exact for the whole argument range
 inline uint16_t div5(uint16_t num, uint16_t &rem)
 {
-    uint16_t q = num*0x6667ul >> 16;
-    q >>= 1;
+    uint16_t q = num*0xCCCDul >> 18;
     rem = num - q*5;
     return q;
 }
 
 inline uint16_t div10(uint16_t num, uint16_t &rem)
 {
-    uint16_t q = num*0x6667ul >> 16;
-    q >>= 2;
+    uint16_t q = num*0xCCCDul >> 19;
     rem = num - q*10;
     return q;
 }
 
+// high 32 bits of 32x32 bit product made of 16x16 bit multiplies,
+// AVR has no 64 bit multiply and libgcc one is much slower
+inline uint32_t mulhi32(uint32_t a, uint32_t b)
+{
+    uint16_t al = a, ah = a >> 16, bl = b, bh = b >> 16;
+    uint32_t lh = (uint32_t)al*bh, hl = (uint32_t)ah*bl;
+    uint32_t mid = ((uint32_t)al*bl >> 16) + (uint16_t)lh + (uint16_t)hl;
+    return (uint32_t)ah*bh + (lh >> 16) + (hl >> 16) + (mid >> 16);
+}
+
 inline uint32_t div10(uint32_t num, uint32_t &rem)
 {
-    uint32_t q = num*0x66666667ull >> 32;
-    q >>= 2;
+    uint32_t q = mulhi32(num, 0xCCCCCCCDul) >> 3;
     rem = num - q*10;
     return q;
 }
 
+inline uint16_t div100(uint16_t num, uint16_t &rem)
+{
+    // num/4/25 keeps the product in 32 bits
+    uint16_t q = (uint32_t)(num >> 2)*5243 >> 17;
+    rem = num - q*100;
+    return q;
+}
+
+inline uint32_t div10000(uint32_t num, uint32_t &rem)
+{
+    uint32_t q = mulhi32(num, 0xD1B71759ul) >> 13;
+    rem = num - q*10000;
+    return q;
+}
+
 inline uint8_t CountOfOnes(uint8_t val)
 {
 	val = (val & 0x55) + ((val >> 1) & 0x55);